@@ -38,6 +38,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  * Instead of tracking 'free rectangles' like other solutions I've found online,
  * this algorithm tracks free 'top lefts', keeps them sorted by closest to origin, and puts new rectangles into
  * the first free top left that doesnt collide. Consuming a top left creates 2 new top lefts (x+w,y) and (x,y+h).
+ * Each top left remembers the smallest size known not to fit there, and each bin its free area, so once a bin fills up
+ * most rectangles are turned down without testing them against every rectangle already placed.
  * If a rectangle doesnt fit into a bin, before condisering the next bin, the current bin is re-tried with the rectangle rotated.
  * This SOMTIMES helps... but not always.. i might disable this in future !?
  * 
@@ -143,6 +145,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include<vector>
 #include<map>
 #include<list>
+#include<limits>
 #include<algorithm>
 #include<math.h>
 #include<sstream>
@@ -257,10 +260,34 @@ public:
 
 template<typename _T> class Canvas {
   
-  Coord::List topLefts;
+  // Where a content can go, with the smallest size known not to fit there. Contents are never
+  // removed, so a size at least as wide and as tall never fits there either.
+  struct TopLeft {
+    
+    typedef std::list<TopLeft> List;
+    
+    Coord coord;
+    Size tooLarge;
+    
+    TopLeft( const Coord &coord )
+      : coord(coord),
+	tooLarge( std::numeric_limits<int>::max(), std::numeric_limits<int>::max() )
+    {}
+  };
+  
+  typename TopLeft::List topLefts;
   typename Content<_T>::Vector contentVector;
   
   bool needToSort;
+  bool allowRotation;
+  
+  // Summaries rejecting in O(1) most contents that can't be placed, once the canvas fills up:
+  // the area left, the room right of and below the top lefts, and the last size that fit
+  // on no top left (until a placement adds new top lefts).
+  long usedArea;
+  int minX;
+  int minY;
+  Size tooLarge;
   
 public:
   
@@ -303,12 +330,17 @@ public:
   const int w;
   const int h;
    
-  Canvas(int w, int h)
+  Canvas(int w, int h, bool allowRotation = true)
     : needToSort(false),
+      allowRotation(allowRotation),
+      usedArea(0),
+      minX(0),
+      minY(0),
+      tooLarge( std::numeric_limits<int>::max(), std::numeric_limits<int>::max() ),
       w(w),
       h(h)
   {  
-    topLefts.push_back( Coord(0,0) );
+    topLefts.push_back( TopLeft( Coord(0,0) ) );
   }
   
   bool HasContent() const {
@@ -347,54 +379,79 @@ public:
   
   bool Place(Content<_T> content) {
      
+    if( (long)content.size.w * content.size.h > (long)w * h - usedArea )
+      return false;
+    
     Sort();
     
-    for( Coord::List::iterator itor = topLefts.begin(); itor != topLefts.end(); itor++ ) {
-      
-      content.coord = *itor;
-      
-      if( Fits( content ) ) {
-	
-	Use( content );
-	topLefts.erase( itor );
-	return true;
-      }
-    }
+    if( PlaceOnTopLefts( content ) )
+      return true;
     
     // EXPERIMENTAL - TRY ROTATED?
+    if( !allowRotation )
+      return false;
+    
     content.Rotate();
-    for( Coord::List::iterator itor = topLefts.begin(); itor != topLefts.end(); itor++ ) {
+    if( PlaceOnTopLefts( content ) )
+      return true;
+    ////////////////////////////////
+    
+    
+    return false;
+  }
+  
+private:
+  
+  static bool Covers( const Size &size, const Size &that ) {
+    
+    return size.w >= that.w && size.h >= that.h;
+  }
+  
+  // On the first top left it fits, in sort order
+  bool PlaceOnTopLefts( Content<_T> &content ) {
+    
+    if( content.size.w > w - minX || content.size.h > h - minY || Covers( content.size, tooLarge ) )
+      return false;
+    
+    for( typename TopLeft::List::iterator itor = topLefts.begin(); itor != topLefts.end(); itor++ ) {
+      
+      if( Covers( content.size, itor->tooLarge ) )
+	continue;
+      
+      content.coord = itor->coord;
       
-      content.coord = *itor;
+      if( (content.coord.x + content.size.w) > w || (content.coord.y + content.size.h) > h )
+	continue;
       
-      if( Fits( content ) ) {
+      const Content<_T> *overlapped = Overlapped( content );
+      
+      if( !overlapped ) {
 	
-	Use( content );
 	topLefts.erase( itor );
+	Use( content );
 	return true;
       }
+      
+      // Whatever reaches the top left of the overlapped content from here doesn't fit either
+      Size blocked( std::max( overlapped->coord.x - content.coord.x, 0 ) + 1,
+		    std::max( overlapped->coord.y - content.coord.y, 0 ) + 1 );
+      
+      if( (long long)blocked.w * blocked.h < (long long)itor->tooLarge.w * itor->tooLarge.h )
+	itor->tooLarge = blocked;
     }
-    ////////////////////////////////
-    
     
+    tooLarge = content.size;
     return false;
   }
   
-private:
-  
-  bool Fits( const Content<_T> &content ) const {
-   
-    if( (content.coord.x + content.size.w) > w )
-      return false;
-    
-    if( (content.coord.y + content.size.h) > h )
-      return false;
+  // The first content in the way, NULL when there is none
+  const Content<_T> *Overlapped( const Content<_T> &content ) const {
     
     for( typename Content<_T>::Vector::const_iterator itor = contentVector.begin(); itor != contentVector.end(); itor++ )  
       if( content.intersects( *itor ) )
-	return false;
+	return &*itor;
     
-    return true;
+    return NULL;
   }
   
   bool Use(const Content<_T> &content) {
@@ -402,10 +459,42 @@ private:
     const Size  &size = content.size;
     const Coord &coord = content.coord;
     
-    topLefts.push_front	( Coord( coord.x + size.w, coord.y          ) );
-    topLefts.push_back	( Coord( coord.x         , coord.y + size.h ) );
+    // Top lefts now under the content can't take anything anymore, nor can those on the edges
+    minX = w;
+    minY = h;
+    for( typename TopLeft::List::iterator itor = topLefts.begin(); itor != topLefts.end(); ) {
+      
+      const Coord &topLeft = itor->coord;
+      
+      if( topLeft.x >= coord.x && topLeft.x < coord.x + size.w &&
+	  topLeft.y >= coord.y && topLeft.y < coord.y + size.h ) {
+	
+	itor = topLefts.erase( itor );
+	continue;
+      }
+      
+      minX = std::min( minX, topLeft.x );
+      minY = std::min( minY, topLeft.y );
+      itor++;
+    }
+    
+    if( coord.x + size.w < w ) {
+      
+      topLefts.push_front( TopLeft( Coord( coord.x + size.w, coord.y ) ) );
+      minX = std::min( minX, coord.x + size.w );
+      minY = std::min( minY, coord.y );
+    }
+    
+    if( coord.y + size.h < h ) {
+      
+      topLefts.push_back( TopLeft( Coord( coord.x, coord.y + size.h ) ) );
+      minX = std::min( minX, coord.x );
+      minY = std::min( minY, coord.y + size.h );
+    }
     
     contentVector.push_back( content );
+    usedArea += (long)size.w * size.h;
+    tooLarge = Size( std::numeric_limits<int>::max(), std::numeric_limits<int>::max() );
     
     needToSort = true;
     
@@ -416,8 +505,11 @@ private:
   
   struct TopToBottomLeftToRightSort {
     
-    bool operator()(const Coord &a, const Coord &b) const {
+    bool operator()(const TopLeft &topLeftA, const TopLeft &topLeftB) const {
      
+      const Coord &a = topLeftA.coord;
+      const Coord &b = topLeftB.coord;
+      
       return ( a.x * a.x + a.y * a.y ) < ( b.x * b.x + b.y * b.y );
     }
   };
@@ -543,29 +635,33 @@ template <typename _T> class UniformCanvasArrayBuilder {
   int w;
   int h;
   int d;
+  bool allowRotation;
   
 public:
   
-  UniformCanvasArrayBuilder( int w, int h, int d )
+  UniformCanvasArrayBuilder( int w, int h, int d, bool allowRotation = true )
     : w(w),
       h(h),
-      d(d)
+      d(d),
+      allowRotation(allowRotation)
   {}
   
   typename Canvas<_T>::Vector Build() {
    
-    return typename Canvas<_T>::Vector(d, Canvas<_T>(w, h) );
+    return typename Canvas<_T>::Vector(d, Canvas<_T>(w, h, allowRotation) );
   }  
 };
 
 template<typename _T> class CanvasArray {
   
   typename Canvas<_T>::Vector canvasArray;
+  std::vector< std::map<int, int> > groupCounts; // Per canvas, contents placed by PlaceGroup
   
 public:  
   
   CanvasArray( const typename Canvas<_T>::Vector &canvasArray )
-    : canvasArray( canvasArray )
+    : canvasArray( canvasArray ),
+      groupCounts( canvasArray.size() )
   {}
 
   bool Place(const typename Content<_T>::Vector &contentVector, typename Content<_T>::Vector &remainder) {
@@ -588,6 +684,83 @@ public:
     return Place( content.Get() );
   }
   
+  // A copy of content on every canvas. Done first, it lands at the same coord on each.
+  bool Reserve( const Content<_T> &content ) {
+    
+    bool placedAll = true;
+    
+    for( typename Canvas<_T>::Vector::iterator itor = canvasArray.begin(); itor != canvasArray.end(); itor++ )
+      if( itor->Place( content ) == false )
+	placedAll = false;
+    
+    return placedAll;
+  }
+  
+  // Contents used together, eg. drawn by the same screen. The whole group goes on the first canvas
+  // holding it entirely, trying canvases that already hold some of the group first. Otherwise it is
+  // spread over as few canvases as possible: those holding the group, then the emptiest ones.
+  bool PlaceGroup( const typename Content<_T>::Vector &contentVector, int group, typename Content<_T>::Vector &remainder ) {
+    
+    std::vector<int> holders;
+    std::vector<int> others;
+    
+    for( int z = 0; z < (int)canvasArray.size(); z++ ) {
+      
+      if( groupCounts[z].count( group ) )
+	holders.push_back( z );
+      else
+	others.push_back( z );
+    }
+    
+    std::stable_sort( holders.begin(), holders.end(), MostOfGroup( groupCounts, group ) );
+    
+    std::vector<int> order = holders;
+    order.insert( order.end(), others.begin(), others.end() );
+    
+    for( std::vector<int>::const_iterator itor = order.begin(); itor != order.end(); itor++ ) {
+      
+      // Placing is deterministic, a successful trial is replayed on the canvas itself
+      Canvas<_T> trial = canvasArray[*itor];
+      typename Content<_T>::Vector left;
+      
+      if( trial.Place( contentVector, left ) ) {
+	
+	PlaceOn( *itor, contentVector, group, left );
+	return true;
+      }
+    }
+    
+    std::stable_sort( others.begin(), others.end(), LeastUsed( canvasArray ) );
+    
+    order = holders;
+    order.insert( order.end(), others.begin(), others.end() );
+    
+    typename Content<_T>::Vector todo = contentVector;
+    
+    for( std::vector<int>::const_iterator itor = order.begin(); itor != order.end() && !todo.empty(); itor++ ) {
+      
+      typename Content<_T>::Vector left;
+      PlaceOn( *itor, todo, group, left );
+      todo = left;
+    }
+    
+    remainder.insert( remainder.end(), todo.begin(), todo.end() );
+    
+    return todo.empty();
+  }
+  
+  // Canvases holding some of the group
+  int Spread( int group ) const {
+    
+    int spread = 0;
+    
+    for( std::vector< std::map<int, int> >::const_iterator itor = groupCounts.begin(); itor != groupCounts.end(); itor++ )
+      if( itor->count( group ) )
+	spread++;
+    
+    return spread;
+  }
+  
   bool CollectContent( typename Content<_T>::Vector &contentVector ) const {
     
     int z = 0;
@@ -613,6 +786,64 @@ public:
     
     return CollectContent( content.Get() );
   }
+  
+  // For placements written outside of this header, see binpack2d_balanced.hpp
+  typename Canvas<_T>::Vector &GetCanvases() {
+    
+    return canvasArray;
+  }
+  
+private:
+  
+  void PlaceOn( int z, const typename Content<_T>::Vector &contentVector, int group, typename Content<_T>::Vector &remainder ) {
+    
+    canvasArray[z].Place( contentVector, remainder );
+    
+    int placed = contentVector.size() - remainder.size();
+    if( placed > 0 )
+      groupCounts[z][group] += placed;
+  }
+  
+  struct MostOfGroup {
+    
+    const std::vector< std::map<int, int> > &groupCounts;
+    int group;
+    
+    MostOfGroup( const std::vector< std::map<int, int> > &groupCounts, int group )
+      : groupCounts( groupCounts ),
+        group( group )
+    {}
+    
+    bool operator()( int a, int b ) const {
+      
+      return groupCounts[a].find( group )->second > groupCounts[b].find( group )->second;
+    }
+  };
+  
+  struct LeastUsed {
+    
+    const typename Canvas<_T>::Vector &canvasArray;
+    
+    LeastUsed( const typename Canvas<_T>::Vector &canvasArray )
+      : canvasArray( canvasArray )
+    {}
+    
+    static long Used( const Canvas<_T> &canvas ) {
+      
+      long area = 0;
+      
+      const typename Content<_T>::Vector &contents = canvas.GetContents();
+      for( typename Content<_T>::Vector::const_iterator itor = contents.begin(); itor != contents.end(); itor++ )
+	area += (long)itor->size.w * itor->size.h;
+      
+      return area;
+    }
+    
+    bool operator()( int a, int b ) const {
+      
+      return Used( canvasArray[a] ) < Used( canvasArray[b] );
+    }
+  };
 };
 
 } /*** BinPack2D ***/
@@ -0,0 +1,211 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+
+/**
+ * PlaceBalanced spreads contents evenly over the canvases of a CanvasArray and fills the canvases
+ * in parallel, where CanvasArray::Place fills them one after the other (the first canvas sees every
+ * content, the last gets what is left).
+ *
+ *   - The contents are dealt by decreasing area, each to the canvas with the least area used so far
+ *     (longest processing time first), counting what the canvases already hold (reserved contents).
+ *   - Each canvas places its share on its own thread, in the order of the input (sort it first).
+ *   - Contents left over by their canvas are dealt again, each to the canvas with the most free area
+ *     among those it wasn't tried on, and placed in parallel again, until every content is placed or
+ *     was tried on every canvas.
+ *
+ * Placements only depend on the input, not on the thread count or timing.
+ * Every canvas gets contents even when fewer would hold them all, as for the layers of a texture array.
+ *
+ * EXAMPLE:
+ *
+ *   BinPack2D::CanvasArray<MyContent> canvasArray =
+ *     BinPack2D::UniformCanvasArrayBuilder<MyContent>(1024, 1024, 32, false).Build();
+ *
+ *   inputContent.Sort();
+ *   BinPack2D::ContentAccumulator<MyContent> remainder;
+ *   BinPack2D::PlaceBalanced( canvasArray, inputContent.Get(), remainder.Get() );
+ *   canvasArray.CollectContent( outputContent );
+ */
+
+
+#pragma once
+
+#include "binpack2d.hpp"
+
+#include<vector>
+#include<algorithm>
+#include<atomic>
+#include<thread>
+
+namespace BinPack2D {
+
+namespace Balanced {
+
+template<typename _T> long Area( const Content<_T> &content ) {
+
+  return (long)content.size.w * content.size.h;
+}
+
+// Places share[z] on canvas z for every z, the canvases on up to threadCount threads
+template<typename _T> void PlaceShares( typename Canvas<_T>::Vector &canvases,
+                                        const std::vector< std::vector<int> > &shares,
+                                        const typename Content<_T>::Vector &contentVector,
+                                        std::vector<char> &placed,
+                                        int threadCount ) {
+
+  std::atomic<int> next( 0 );
+
+  auto work = [&]() {
+
+    for( int z = next++; z < (int)canvases.size(); z = next++ ) {
+
+      // Each thread writes 'placed' for the contents of its own canvases only
+      for( std::vector<int>::const_iterator itor = shares[z].begin(); itor != shares[z].end(); itor++ )
+        placed[*itor] = canvases[z].Place( contentVector[*itor] ) ? 1 : 0;
+    }
+  };
+
+  int busy = 0;
+  for( int z = 0; z < (int)canvases.size(); z++ )
+    if( !shares[z].empty() )
+      busy++;
+
+  std::vector<std::thread> threads;
+  for( int i = 1; i < std::min( threadCount, busy ); i++ )
+    threads.push_back( std::thread( work ) );
+
+  work();
+
+  for( std::vector<std::thread>::iterator itor = threads.begin(); itor != threads.end(); itor++ )
+    itor->join();
+}
+
+} /*** Balanced ***/
+
+// threadCount 0 for one per core. Returns false when some contents are in the remainder.
+template<typename _T> bool PlaceBalanced( CanvasArray<_T> &canvasArray,
+                                          const typename Content<_T>::Vector &contentVector,
+                                          typename Content<_T>::Vector &remainder,
+                                          int threadCount = 0 ) {
+
+  typename Canvas<_T>::Vector &canvases = canvasArray.GetCanvases();
+  int count = (int)canvases.size();
+
+  if( threadCount <= 0 )
+    threadCount = std::max( 1u, std::thread::hardware_concurrency() );
+
+  // Area used on each canvas, placed or promised
+  std::vector<long> used( count, 0 );
+  for( int z = 0; z < count; z++ ) {
+
+    const typename Content<_T>::Vector &contents = canvases[z].GetContents();
+    for( typename Content<_T>::Vector::const_iterator itor = contents.begin(); itor != contents.end(); itor++ )
+      used[z] += Balanced::Area( *itor );
+  }
+
+  // Largest first
+  std::vector<int> byArea;
+  for( int i = 0; i < (int)contentVector.size(); i++ )
+    byArea.push_back( i );
+
+  std::stable_sort( byArea.begin(), byArea.end(), [&]( int a, int b ) {
+    return Balanced::Area( contentVector[a] ) > Balanced::Area( contentVector[b] );
+  } );
+
+  std::vector< std::vector<int> > shares( count );
+  for( std::vector<int>::const_iterator itor = byArea.begin(); itor != byArea.end(); itor++ ) {
+
+    int z = (int)( std::min_element( used.begin(), used.end() ) - used.begin() );
+    shares[z].push_back( *itor );
+    used[z] += Balanced::Area( contentVector[*itor] );
+  }
+
+  // Each canvas places its share in input order, the order the caller sorted for
+  for( int z = 0; z < count; z++ )
+    std::sort( shares[z].begin(), shares[z].end() );
+
+  std::vector<char> placed( contentVector.size(), 0 );
+  std::vector< std::vector<char> > tried( contentVector.size(), std::vector<char>( count, 0 ) );
+
+  while( true ) {
+
+    for( int z = 0; z < count; z++ )
+      for( std::vector<int>::const_iterator itor = shares[z].begin(); itor != shares[z].end(); itor++ )
+        tried[*itor][z] = 1;
+
+    Balanced::PlaceShares<_T>( canvases, shares, contentVector, placed, threadCount );
+
+    // What is left goes where the most area is free, never twice on the same canvas
+    for( int z = 0; z < count; z++ ) {
+
+      used[z] = 0;
+      const typename Content<_T>::Vector &contents = canvases[z].GetContents();
+      for( typename Content<_T>::Vector::const_iterator itor = contents.begin(); itor != contents.end(); itor++ )
+        used[z] += Balanced::Area( *itor );
+    }
+
+    std::vector< std::vector<int> > overflow( count );
+    bool any = false;
+
+    for( std::vector<int>::const_iterator itor = byArea.begin(); itor != byArea.end(); itor++ ) {
+
+      if( placed[*itor] )
+        continue;
+
+      int best = -1;
+      for( int z = 0; z < count; z++ )
+        if( !tried[*itor][z] && ( best < 0 || used[z] < used[best] ) )
+          best = z;
+
+      if( best < 0 )
+        continue;
+
+      overflow[best].push_back( *itor );
+      used[best] += Balanced::Area( contentVector[*itor] );
+      any = true;
+    }
+
+    if( !any )
+      break;
+
+    for( int z = 0; z < count; z++ )
+      std::sort( overflow[z].begin(), overflow[z].end() );
+
+    shares.swap( overflow );
+  }
+
+  bool placedAll = true;
+  for( int i = 0; i < (int)contentVector.size(); i++ ) {
+
+    if( placed[i] )
+      continue;
+
+    remainder.push_back( contentVector[i] );
+    placedAll = false;
+  }
+
+  return placedAll;
+}
+
+} /*** BinPack2D ***/
@@ -0,0 +1,374 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+
+/**
+ * ShardedCanvas is a thread-safe front-end to DynamicCanvas.
+ *
+ * The canvas is cut in horizontal regions ('shards'), each one a DynamicCanvas with its own lock.
+ * A thread inserts into its home shard (picked from its thread id) so threads mostly never touch
+ * the same lock. When the home shard is busy or full, neighbouring shards are tried, first without
+ * blocking and then blocking. Each shard publishes its free area so full shards are skipped without
+ * taking their lock.
+ *
+ * Handles, coordinates and CollectContent() are in canvas space, the shards are invisible to
+ * the caller, except that a rectangle must fit in one shard: anything taller than MaxItemHeight()
+ * is rejected even on an empty canvas. Use fewer shards for atlases holding tall rectangles.
+ *
+ * EXAMPLE:
+ *
+ *   BinPack2D::ShardedCanvas<MyGlyph> atlas(2048, 2048, 8);
+ *
+ *   // From any thread
+ *   BinPack2D::ShardedCanvas<MyGlyph>::Handle handle = atlas.Insert( glyph, BinPack2D::Size(12, 16) );
+ *
+ *   BinPack2D::Content<MyGlyph> content( glyph, BinPack2D::Coord(), BinPack2D::Size(0, 0), false );
+ *   if( atlas.Get( handle, content ) ) ... // content.coord
+ *
+ *   // One view of everything
+ *   BinPack2D::Content<MyGlyph>::Vector contents;
+ *   atlas.CollectContent( contents );
+ */
+
+
+#pragma once
+
+#include "binpack2d.hpp"
+#include "binpack2d_dynamic.hpp"
+
+#include<vector>
+#include<atomic>
+#include<bitset>
+#include<functional>
+#include<mutex>
+#include<thread>
+
+namespace BinPack2D {
+
+template<typename _T> class ShardedCanvas {
+
+public:
+
+  // DynamicCanvas handle with the shard in bits 24..31, the bits it leaves unused
+  typedef unsigned long long Handle;
+
+  static const Handle InvalidHandle = 0;
+
+  typedef typename DynamicCanvas<_T>::Move Move;
+
+  const int w;
+  const int h;
+
+  ShardedCanvas(int w, int h, int shardCount, int shelfGranularity = 8)
+    : w(w),
+      h(h)
+  {
+    if( shardCount < 1 )
+      shardCount = 1;
+
+    if( shardCount > h )
+      shardCount = h;
+
+    if( shardCount > MaxShards )
+      shardCount = MaxShards;
+
+    maxItemHeight = h;
+
+    for( int i = 0; i < shardCount; i++ ) {
+
+      int top = ( h * i ) / shardCount;
+      int bottom = ( h * ( i + 1 ) ) / shardCount;
+
+      shards.push_back( new Shard( top, w, bottom - top, shelfGranularity ) );
+
+      if( bottom - top < maxItemHeight )
+	maxItemHeight = bottom - top;
+    }
+
+    // Home first, then steal from the closest neighbours: home+1, home-1, home+2...
+    orders.resize( shardCount );
+
+    for( int home = 0; home < shardCount; home++ ) {
+
+      std::vector<int> &order = orders[home];
+      order.push_back( home );
+
+      for( int d = 1; (int)order.size() < shardCount; d++ ) {
+
+	if( home + d < shardCount ) order.push_back( home + d );
+	if( home - d >= 0 ) order.push_back( home - d );
+      }
+    }
+  }
+
+  ~ShardedCanvas() {
+
+    for( typename std::vector<Shard*>::iterator itor = shards.begin(); itor != shards.end(); itor++ )
+      delete *itor;
+  }
+
+  // Thread-safe. Returns InvalidHandle when no shard has room, or when the rectangle is taller
+  // than MaxItemHeight().
+  Handle Insert( const _T &content, const Size &size ) {
+
+    if( size.h > maxItemHeight )
+      return InvalidHandle;
+
+    int area = size.w * size.h;
+    const std::vector<int> &order = orders[ HomeShard() ];
+
+    // Don't wait on a busy shard while another one is free.
+    std::bitset<MaxShards> busy;
+    for( std::vector<int>::const_iterator itor = order.begin(); itor != order.end(); itor++ ) {
+
+      Shard &shard = *shards[*itor];
+
+      if( shard.freeArea.load( std::memory_order_relaxed ) < area )
+	continue;
+
+      std::unique_lock<std::mutex> lock( shard.mutex, std::try_to_lock );
+
+      if( !lock.owns_lock() ) {
+
+	busy.set( *itor );
+	continue;
+      }
+
+      Handle handle = Insert( *itor, content, size );
+
+      if( handle != InvalidHandle )
+	return handle;
+    }
+
+    for( std::vector<int>::const_iterator itor = order.begin(); itor != order.end() && busy.any(); itor++ ) {
+
+      if( !busy.test( *itor ) )
+	continue;
+
+      Shard &shard = *shards[*itor];
+
+      if( shard.freeArea.load( std::memory_order_relaxed ) < area )
+	continue;
+
+      std::lock_guard<std::mutex> lock( shard.mutex );
+
+      Handle handle = Insert( *itor, content, size );
+
+      if( handle != InvalidHandle )
+	return handle;
+    }
+
+    return InvalidHandle;
+  }
+
+  // Thread-safe.
+  bool Remove( Handle handle ) {
+
+    int shardIndex = ShardIndex( handle );
+
+    if( shardIndex < 0 )
+      return false;
+
+    Shard &shard = *shards[shardIndex];
+
+    std::lock_guard<std::mutex> lock( shard.mutex );
+
+    if( !shard.canvas.Remove( LocalHandle( handle ) ) )
+      return false;
+
+    shard.freeArea.store( shard.canvas.FreeArea(), std::memory_order_relaxed );
+
+    return true;
+  }
+
+  // Thread-safe. The content is copied out, it can move on the next Defragment().
+  bool Get( Handle handle, Content<_T> &content ) const {
+
+    int shardIndex = ShardIndex( handle );
+
+    if( shardIndex < 0 )
+      return false;
+
+    Shard &shard = *shards[shardIndex];
+
+    std::lock_guard<std::mutex> lock( shard.mutex );
+
+    const Content<_T> *found = shard.canvas.Get( LocalHandle( handle ) );
+
+    if( !found )
+      return false;
+
+    content = *found;
+    content.coord.y += shard.top;
+
+    return true;
+  }
+
+  // Thread-safe. Defragment every shard with a share of 'budget', moves are in canvas space.
+  // A shard gets an even share of what is left, so budget a shard doesn't spend goes to the next.
+  int Defragment( int budget, typename Move::Vector &moves ) {
+
+    int moved = 0;
+    int count = (int)shards.size();
+
+    for( int i = 0; i < count && moved < budget; i++ ) {
+
+      int remaining = budget - moved;
+      int shardBudget = ( remaining + count - i - 1 ) / ( count - i );
+
+      Shard &shard = *shards[i];
+      typename Move::Vector shardMoves;
+
+      {
+	std::lock_guard<std::mutex> lock( shard.mutex );
+
+	moved += shard.canvas.Defragment( shardBudget, shardMoves );
+	shard.freeArea.store( shard.canvas.FreeArea(), std::memory_order_relaxed );
+      }
+
+      for( typename Move::Vector::iterator itor = shardMoves.begin(); itor != shardMoves.end(); itor++ ) {
+
+	itor->handle = MakeHandle( i, itor->handle );
+	itor->from.y += shard.top;
+	itor->to.y += shard.top;
+	moves.push_back( *itor );
+      }
+    }
+
+    return moved;
+  }
+
+  // Tallest rectangle Insert() accepts, the height of the smallest shard.
+  int MaxItemHeight() const {
+
+    return maxItemHeight;
+  }
+
+  int FreeArea() const {
+
+    int freeArea = 0;
+
+    for( typename std::vector<Shard*>::const_iterator itor = shards.begin(); itor != shards.end(); itor++ )
+      freeArea += (*itor)->freeArea.load( std::memory_order_relaxed );
+
+    return freeArea;
+  }
+
+  // Thread-safe. Every shard is locked in turn, the result is in canvas space.
+  bool CollectContent( typename Content<_T>::Vector &contentVector ) const {
+
+    for( typename std::vector<Shard*>::const_iterator itor = shards.begin(); itor != shards.end(); itor++ ) {
+
+      Shard &shard = **itor;
+      size_t first = contentVector.size();
+
+      {
+	std::lock_guard<std::mutex> lock( shard.mutex );
+
+	shard.canvas.CollectContent( contentVector );
+      }
+
+      for( size_t i = first; i < contentVector.size(); i++ )
+	contentVector[i].coord.y += shard.top;
+    }
+
+    return true;
+  }
+
+  bool CollectContent( ContentAccumulator<_T> &content ) const {
+
+    return CollectContent( content.Get() );
+  }
+
+private:
+
+  struct Shard {
+
+    int top;
+    DynamicCanvas<_T> canvas;
+    std::atomic<int> freeArea;
+    mutable std::mutex mutex;
+
+    Shard( int top, int w, int h, int shelfGranularity )
+      : top(top),
+        canvas(w, h, shelfGranularity),
+        freeArea(w * h)
+    {}
+  };
+
+  std::vector<Shard*> shards;
+  std::vector< std::vector<int> > orders; // Shards to try for each home shard
+  int maxItemHeight;
+
+  static const int ShardShift = 24;
+  static const int MaxShards = 256;
+
+  // Not copyable, shards own their lock.
+  ShardedCanvas( const ShardedCanvas & );
+  ShardedCanvas &operator = ( const ShardedCanvas & );
+
+  // Caller holds the shard lock.
+  Handle Insert( int shardIndex, const _T &content, const Size &size ) {
+
+    Shard &shard = *shards[shardIndex];
+
+    typename DynamicCanvas<_T>::Handle local = shard.canvas.Insert( content, size );
+
+    if( local == DynamicCanvas<_T>::InvalidHandle )
+      return InvalidHandle;
+
+    shard.freeArea.store( shard.canvas.FreeArea(), std::memory_order_relaxed );
+
+    return MakeHandle( shardIndex, local );
+  }
+
+  int HomeShard() const {
+
+    return (int)( std::hash<std::thread::id>()( std::this_thread::get_id() ) % shards.size() );
+  }
+
+  static Handle MakeHandle( int shardIndex, typename DynamicCanvas<_T>::Handle local ) {
+
+    return ( (Handle)shardIndex << ShardShift ) | local;
+  }
+
+  static typename DynamicCanvas<_T>::Handle LocalHandle( Handle handle ) {
+
+    return (typename DynamicCanvas<_T>::Handle)( handle & ~( 0xffull << ShardShift ) );
+  }
+
+  int ShardIndex( Handle handle ) const {
+
+    if( LocalHandle( handle ) == DynamicCanvas<_T>::InvalidHandle )
+      return -1;
+
+    int shardIndex = (int)( ( handle >> ShardShift ) & 0xff );
+
+    if( shardIndex >= (int)shards.size() )
+      return -1;
+
+    return shardIndex;
+  }
+};
+
+} /*** BinPack2D ***/
@@ -0,0 +1,614 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+
+/**
+ * DynamicCanvas is the online counterpart of BinPack2D::Canvas, for atlases that live as long as
+ * the application (glyph caches, streamed sprites...). Rectangles can be inserted and removed
+ * one at a time, each insert returns a stable handle.
+ *
+ * The canvas is cut in horizontal shelves. A shelf is as wide as the canvas and its height is the
+ * height of the first rectangle it received, rounded up to 'shelfGranularity'. Free space inside
+ * shelves is kept as spans in an ordered set, so both Insert() and Remove() are O(log n).
+ * Freed spans are merged with their neighbours and an empty shelf goes back to the free vertical
+ * space, where it can be cut again at another height.
+ *
+ * Defragment() never re-packs the whole canvas: each call empties whole shelves, least used first,
+ * into the free spans of other shelves within a texel budget, and reports every move so the
+ * caller can copy the texels (glCopyImageSubData...). Handles stay valid across moves.
+ *
+ * EXAMPLE:
+ *
+ *   BinPack2D::DynamicCanvas<MyGlyph> atlas(1024, 1024);
+ *
+ *   BinPack2D::DynamicCanvas<MyGlyph>::Handle handle = atlas.Insert( glyph, BinPack2D::Size(12, 16) );
+ *   if( handle == atlas.InvalidHandle ) ... // full
+ *
+ *   const BinPack2D::Content<MyGlyph> *content = atlas.Get( handle ); // content->coord
+ *
+ *   atlas.Remove( handle );
+ *
+ *   // Once per frame, copy at most 64k texels around.
+ *   BinPack2D::DynamicCanvas<MyGlyph>::Move::Vector moves;
+ *   atlas.Defragment( 65536, moves );
+ */
+
+
+#pragma once
+
+#include "binpack2d.hpp"
+
+#include<vector>
+#include<map>
+#include<set>
+#include<utility>
+
+namespace BinPack2D {
+
+template<typename _T> class DynamicCanvas {
+
+public:
+
+  // (generation << 32) | (slot + 1), the bits between them are left for ShardedCanvas
+  typedef unsigned long long Handle;
+
+  static const Handle InvalidHandle = 0;
+
+  class Move {
+
+  public:
+
+    typedef std::vector<Move> Vector;
+
+    Handle handle;
+    Coord  from;
+    Coord  to;
+    Size   size;
+
+    Move( Handle handle, const Coord &from, const Coord &to, const Size &size )
+      : handle(handle),
+        from(from),
+        to(to),
+        size(size)
+    {}
+  };
+
+  const int w;
+  const int h;
+
+  DynamicCanvas(int w, int h, int shelfGranularity = 8)
+    : w(w),
+      h(h),
+      granularity(shelfGranularity > 0 ? shelfGranularity : 1),
+      freeArea(w * h),
+      firstFreeSlot(-1)
+  {
+    ReleaseBand( 0, h );
+  }
+
+  // Place a rectangle, returns InvalidHandle if there is no room left.
+  Handle Insert( const _T &content, const Size &size ) {
+
+    if( size.w <= 0 || size.h <= 0 || size.w > w || size.h > h )
+      return InvalidHandle;
+
+    // Every slot a handle can name is taken, checked before a shelf is opened for nothing
+    if( firstFreeSlot < 0 && slots.size() >= SlotMask )
+      return InvalidHandle;
+
+    int shelfIndex;
+    int x;
+
+    if( !FindSpan( size, shelfIndex, x ) && !OpenShelf( size, shelfIndex, x ) )
+      return InvalidHandle;
+
+    int slotIndex = AllocateSlot( Content<_T>( content, Coord( x, shelves[shelfIndex].y ), size, false ) );
+
+    Assign( slotIndex, shelfIndex, x );
+
+    return MakeHandle( slotIndex );
+  }
+
+  // Free a rectangle, its space is immediately available to Insert().
+  bool Remove( Handle handle ) {
+
+    int slotIndex = SlotIndex( handle );
+
+    if( slotIndex < 0 )
+      return false;
+
+    Unassign( slotIndex );
+
+    Slot &slot = slots[slotIndex];
+    slot.used = false;
+
+    // A slot whose generation would wrap is retired, so old handles can't name it again
+    if( ++slot.generation == 0 )
+      return true;
+
+    slot.nextFree = firstFreeSlot;
+    firstFreeSlot = slotIndex;
+
+    return true;
+  }
+
+  // NULL if the handle was removed.
+  const Content<_T> *Get( Handle handle ) const {
+
+    int slotIndex = SlotIndex( handle );
+
+    if( slotIndex < 0 )
+      return NULL;
+
+    return &slots[slotIndex].content;
+  }
+
+  // Empty the least used shelves into the spans of other shelves while the budget allows it.
+  // A shelf is only emptied whole, one that doesn't fit elsewhere or in what is left of 'budget'
+  // is left as it is. Returns the number of texels moved, every move is appended to 'moves' in order.
+  int Defragment( int budget, typename Move::Vector &moves ) {
+
+    int moved = 0;
+    std::set<int> visitedShelves; // Victims and the shelves moved into, nothing is moved twice
+
+    while( moved < budget ) {
+
+      int victim = LeastUsedShelf( visitedShelves );
+
+      if( victim < 0 )
+	break;
+
+      visitedShelves.insert( victim );
+
+      // Copy the list, moving items out modifies it.
+      std::vector<int> items( shelves[victim].items.begin(), shelves[victim].items.end() );
+
+      int area = 0;
+      for( std::vector<int>::const_iterator itor = items.begin(); itor != items.end(); itor++ )
+	area += slots[*itor].content.size.w * slots[*itor].content.size.h;
+
+      // The other shelves are used more, they won't fit either.
+      if( area > budget - moved )
+	break;
+
+      std::vector< std::pair<int, int> > targets;
+
+      if( !PlanEviction( victim, items, targets ) )
+	continue;
+
+      for( int i = 0; i < (int)items.size(); i++ ) {
+
+	Slot &slot = slots[items[i]];
+	int shelfIndex = targets[i].first;
+	int x = targets[i].second;
+
+	Coord from = slot.content.coord;
+
+	Unassign( items[i] );
+	slot.content.coord = Coord( x, shelves[shelfIndex].y );
+	Assign( items[i], shelfIndex, x );
+
+	moves.push_back( Move( MakeHandle( items[i] ), from, slot.content.coord, slot.content.size ) );
+	visitedShelves.insert( shelfIndex );
+      }
+
+      moved += area;
+    }
+
+    return moved;
+  }
+
+  bool HasContent() const {
+
+    return freeArea != w * h;
+  }
+
+  int FreeArea() const {
+
+    return freeArea;
+  }
+
+  bool CollectContent( typename Content<_T>::Vector &contentVector ) const {
+
+    for( typename std::vector<Slot>::const_iterator itor = slots.begin(); itor != slots.end(); itor++ )
+      if( itor->used )
+	contentVector.push_back( itor->content );
+
+    return true;
+  }
+
+private:
+
+  struct Slot {
+
+    Content<_T> content;
+    unsigned generation;
+    bool used;
+    int shelf;
+    int nextFree;
+
+    Slot( const Content<_T> &content )
+      : content(content),
+        generation(1),
+        used(true),
+        shelf(-1),
+        nextFree(-1)
+    {}
+  };
+
+  struct Shelf {
+
+    int y;
+    int h;
+    bool alive;
+    std::map<int, int> freeSpans; // x -> w
+    std::set<int> items;          // slot indices
+
+    Shelf( int y, int h )
+      : y(y),
+        h(h),
+        alive(true)
+    {}
+  };
+
+  // (shelf height, span width, shelf, x), best fit is the first entry not less than (h, w).
+  struct Span {
+
+    int shelfH;
+    int w;
+    int shelf;
+    int x;
+
+    Span( int shelfH, int w, int shelf, int x )
+      : shelfH(shelfH),
+        w(w),
+        shelf(shelf),
+        x(x)
+    {}
+
+    bool operator < ( const Span &that ) const {
+
+      if(this->shelfH != that.shelfH) return this->shelfH < that.shelfH;
+      if(this->w != that.w) return this->w < that.w;
+      if(this->shelf != that.shelf) return this->shelf < that.shelf;
+      return this->x < that.x;
+    }
+  };
+
+  // A removed handle never matches a reused slot: the generation changes on every Remove() and
+  // slots are retired before it wraps.
+  static const unsigned SlotBits = 24;
+  static const unsigned SlotMask = (1u << SlotBits) - 1;
+
+  int granularity;
+  int freeArea;
+  int firstFreeSlot;
+
+  std::vector<Slot> slots;
+  std::vector<Shelf> shelves;
+  std::vector<int> deadShelves;
+
+  std::set<Span> spans;
+  std::map<int, int> bands;                // free vertical space, y -> h
+  std::set< std::pair<int, int> > bandsBySize; // (h, y)
+
+  Handle MakeHandle( int slotIndex ) const {
+
+    return ( (Handle)slots[slotIndex].generation << 32 ) | (Handle)( slotIndex + 1 );
+  }
+
+  int SlotIndex( Handle handle ) const {
+
+    if( handle & ~( ( 0xffffffffull << 32 ) | SlotMask ) )
+      return -1;
+
+    int slotIndex = (int)( handle & SlotMask ) - 1;
+
+    if( slotIndex < 0 || slotIndex >= (int)slots.size() )
+      return -1;
+
+    const Slot &slot = slots[slotIndex];
+
+    if( !slot.used || MakeHandle( slotIndex ) != handle )
+      return -1;
+
+    return slotIndex;
+  }
+
+  // Insert() made sure a slot is free or can be added below SlotMask
+  int AllocateSlot( const Content<_T> &content ) {
+
+    if( firstFreeSlot < 0 ) {
+
+      slots.push_back( Slot( content ) );
+      return (int)slots.size() - 1;
+    }
+
+    int slotIndex = firstFreeSlot;
+    Slot &slot = slots[slotIndex];
+
+    firstFreeSlot = slot.nextFree;
+    slot.content = content;
+    slot.used = true;
+    slot.nextFree = -1;
+
+    return slotIndex;
+  }
+
+  int ShelfHeight( int h ) const {
+
+    return ( ( h + granularity - 1 ) / granularity ) * granularity;
+  }
+
+  // Best fit among existing shelves tall enough, without wasting more than half the shelf height.
+  typename std::set<Span>::const_iterator FindSpan( const std::set<Span> &spanSet, const Size &size, int excludedShelf ) const {
+
+    int maxShelfH = ShelfHeight( size.h + size.h / 2 );
+
+    typename std::set<Span>::const_iterator itor = spanSet.lower_bound( Span( size.h, size.w, -1, -1 ) );
+
+    while( itor != spanSet.end() && itor->shelfH <= maxShelfH ) {
+
+      if( itor->w < size.w ) {
+
+	// Nothing wide enough left at this height, jump to the next one.
+	itor = spanSet.lower_bound( Span( itor->shelfH, size.w, -1, -1 ) );
+	continue;
+      }
+
+      if( itor->shelf != excludedShelf )
+	return itor;
+
+      itor++;
+    }
+
+    return spanSet.end();
+  }
+
+  bool FindSpan( const Size &size, int &shelfIndex, int &x ) const {
+
+    typename std::set<Span>::const_iterator span = FindSpan( spans, size, -1 );
+
+    if( span == spans.end() )
+      return false;
+
+    shelfIndex = span->shelf;
+    x = span->x;
+    return true;
+  }
+
+  // Where each item of the victim would go, carved from a copy of the spans the way Assign() does.
+  // False when one of them has no room, nothing is moved then.
+  bool PlanEviction( int victim, const std::vector<int> &items, std::vector< std::pair<int, int> > &targets ) const {
+
+    std::set<Span> trial( spans );
+
+    for( std::vector<int>::const_iterator itor = items.begin(); itor != items.end(); itor++ ) {
+
+      const Size &size = slots[*itor].content.size;
+
+      typename std::set<Span>::const_iterator span = FindSpan( trial, size, victim );
+
+      if( span == trial.end() )
+	return false;
+
+      Span taken = *span;
+      trial.erase( span );
+
+      if( taken.w > size.w )
+	trial.insert( Span( taken.shelfH, taken.w - size.w, taken.shelf, taken.x + size.w ) );
+
+      targets.push_back( std::make_pair( taken.shelf, taken.x ) );
+    }
+
+    return true;
+  }
+
+  bool OpenShelf( const Size &size, int &shelfIndex, int &x ) {
+
+    int shelfH = ShelfHeight( size.h );
+
+    std::set< std::pair<int, int> >::iterator band = bandsBySize.lower_bound( std::make_pair( shelfH, -1 ) );
+
+    if( band == bandsBySize.end() ) {
+
+      // Granularity rounding can overflow the canvas, the last band may still fit the exact height.
+      band = bandsBySize.lower_bound( std::make_pair( size.h, -1 ) );
+
+      if( band == bandsBySize.end() )
+	return false;
+
+      shelfH = band->first;
+    }
+
+    int bandY = band->second;
+    int bandH = band->first;
+
+    TakeBand( bandY, bandH );
+
+    if( bandH > shelfH )
+      ReleaseBand( bandY + shelfH, bandH - shelfH );
+
+    if( deadShelves.empty() ) {
+
+      shelves.push_back( Shelf( bandY, shelfH ) );
+      shelfIndex = (int)shelves.size() - 1;
+    }
+    else {
+
+      shelfIndex = deadShelves.back();
+      deadShelves.pop_back();
+      shelves[shelfIndex] = Shelf( bandY, shelfH );
+    }
+
+    AddSpan( shelfIndex, 0, w );
+    x = 0;
+
+    return true;
+  }
+
+  void CloseShelf( int shelfIndex ) {
+
+    Shelf &shelf = shelves[shelfIndex];
+
+    RemoveSpan( shelfIndex, 0 );
+    ReleaseBand( shelf.y, shelf.h );
+
+    shelf.alive = false;
+    deadShelves.push_back( shelfIndex );
+  }
+
+  void TakeBand( int y, int h ) {
+
+    bands.erase( y );
+    bandsBySize.erase( std::make_pair( h, y ) );
+  }
+
+  void ReleaseBand( int y, int h ) {
+
+    std::map<int, int>::iterator next = bands.lower_bound( y );
+
+    if( next != bands.end() && next->first == y + h ) {
+
+      h += next->second;
+      TakeBand( next->first, next->second );
+    }
+
+    std::map<int, int>::iterator prev = bands.lower_bound( y );
+
+    if( prev != bands.begin() ) {
+
+      prev--;
+
+      if( prev->first + prev->second == y ) {
+
+	y = prev->first;
+	h += prev->second;
+	TakeBand( prev->first, prev->second );
+      }
+    }
+
+    bands[y] = h;
+    bandsBySize.insert( std::make_pair( h, y ) );
+  }
+
+  void AddSpan( int shelfIndex, int x, int spanW ) {
+
+    Shelf &shelf = shelves[shelfIndex];
+
+    shelf.freeSpans[x] = spanW;
+    spans.insert( Span( shelf.h, spanW, shelfIndex, x ) );
+  }
+
+  void RemoveSpan( int shelfIndex, int x ) {
+
+    Shelf &shelf = shelves[shelfIndex];
+
+    std::map<int, int>::iterator span = shelf.freeSpans.find( x );
+
+    spans.erase( Span( shelf.h, span->second, shelfIndex, x ) );
+    shelf.freeSpans.erase( span );
+  }
+
+  // Carve the slot rectangle out of the span starting at 'x'.
+  void Assign( int slotIndex, int shelfIndex, int x ) {
+
+    Slot &slot = slots[slotIndex];
+    Shelf &shelf = shelves[shelfIndex];
+
+    int spanW = shelf.freeSpans[x];
+
+    RemoveSpan( shelfIndex, x );
+
+    if( spanW > slot.content.size.w )
+      AddSpan( shelfIndex, x + slot.content.size.w, spanW - slot.content.size.w );
+
+    slot.shelf = shelfIndex;
+    shelf.items.insert( slotIndex );
+
+    freeArea -= slot.content.size.w * slot.content.size.h;
+  }
+
+  // Give the slot rectangle back to its shelf, merging with the neighbouring spans.
+  void Unassign( int slotIndex ) {
+
+    Slot &slot = slots[slotIndex];
+    int shelfIndex = slot.shelf;
+    Shelf &shelf = shelves[shelfIndex];
+
+    int x = slot.content.coord.x;
+    int spanW = slot.content.size.w;
+
+    std::map<int, int>::iterator next = shelf.freeSpans.lower_bound( x );
+
+    if( next != shelf.freeSpans.end() && next->first == x + spanW ) {
+
+      spanW += next->second;
+      RemoveSpan( shelfIndex, next->first );
+    }
+
+    std::map<int, int>::iterator prev = shelf.freeSpans.lower_bound( x );
+
+    if( prev != shelf.freeSpans.begin() ) {
+
+      prev--;
+
+      if( prev->first + prev->second == x ) {
+
+	x = prev->first;
+	spanW += prev->second;
+	RemoveSpan( shelfIndex, prev->first );
+      }
+    }
+
+    AddSpan( shelfIndex, x, spanW );
+
+    shelf.items.erase( slotIndex );
+    slot.shelf = -1;
+
+    freeArea += slot.content.size.w * slot.content.size.h;
+
+    if( shelf.items.empty() )
+      CloseShelf( shelfIndex );
+  }
+
+  int LeastUsedShelf( const std::set<int> &skippedShelves ) const {
+
+    int best = -1;
+
+    for( int i = 0; i < (int)shelves.size(); i++ ) {
+
+      const Shelf &shelf = shelves[i];
+
+      if( !shelf.alive || skippedShelves.count( i ) )
+	continue;
+
+      if( best < 0 || shelf.items.size() < shelves[best].items.size() )
+	best = i;
+    }
+
+    return best;
+  }
+};
+
+} /*** BinPack2D ***/
@@ -0,0 +1,409 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+
+/**
+ * ExactCanvas searches every top-left justified packing of a few contents (up to 64) in a canvas,
+ * for when Canvas misses a packing that exists. It either finds one, proves there is none, or runs
+ * out of time.
+ *
+ * Contents go on the corner points of the staircase left by the contents already placed (the
+ * positions where a content can't slide up or left), any content on any corner. Branches are cut when:
+ *   - the remaining area exceeds the area outside the staircase,
+ *   - a remaining content fits on no corner, the staircase only grows,
+ *   - a content has the size of one already tried on this node,
+ *   - the same staircase with the same contents left was already searched (a table per thread).
+ *
+ * The first two contents (the first always at 0,0, the second under or right of it) split the search
+ * in branches shared by the worker threads.
+ * The first thread finding a packing stops the others.
+ *
+ * EXAMPLE:
+ *
+ *   BinPack2D::ExactCanvas<MyContent> canvas(256, 128);
+ *
+ *   switch( canvas.Place( inputContent.Get(), 10.0 ) ) {
+ *     case BinPack2D::ExactCanvas<MyContent>::FOUND:      canvas.CollectContent( outputContent ); break;
+ *     case BinPack2D::ExactCanvas<MyContent>::INFEASIBLE: ... // no packing in 256x128
+ *     case BinPack2D::ExactCanvas<MyContent>::UNKNOWN:    ... // time limit
+ *   }
+ */
+
+
+#pragma once
+
+#include "binpack2d.hpp"
+
+#include<vector>
+#include<unordered_set>
+#include<string>
+#include<algorithm>
+#include<atomic>
+#include<chrono>
+#include<mutex>
+#include<thread>
+#include<stdint.h>
+
+namespace BinPack2D {
+
+template<typename _T> class ExactCanvas {
+
+public:
+
+  enum Result { FOUND, INFEASIBLE, UNKNOWN };
+
+  const int w;
+  const int h;
+
+  ExactCanvas( int w, int h )
+    : w(w),
+      h(h)
+  {}
+
+  // Gives up with UNKNOWN after 'seconds', or right away for more than 64 contents.
+  Result Place( const typename Content<_T>::Vector &contents, double seconds, unsigned threads = std::thread::hardware_concurrency() ) {
+
+    contentVector.clear();
+
+    if( contents.empty() )
+      return FOUND;
+
+    if( contents.size() > 64 )
+      return UNKNOWN;
+
+    // Largest first, same sizes next to each other
+    items.clear();
+    long area = 0;
+    for( typename Content<_T>::Vector::const_iterator itor = contents.begin(); itor != contents.end(); itor++ ) {
+
+      if( itor->size.w > w || itor->size.h > h )
+        return INFEASIBLE;
+
+      Item item = { itor->size.w, itor->size.h, (long)itor->size.w * itor->size.h, 0 };
+      items.push_back( item );
+      area += item.area;
+    }
+
+    if( area > (long)w * h )
+      return INFEASIBLE;
+
+    std::vector<int> order( items.size() );
+    for( int i = 0; i < (int)order.size(); i++ ) order[i] = i;
+    std::stable_sort( order.begin(), order.end(), LargestFirst( items ) );
+
+    std::vector<Item> sorted;
+    for( int i = 0; i < (int)order.size(); i++ ) sorted.push_back( items[order[i]] );
+    items = sorted;
+
+    for( int i = 1; i < (int)items.size(); i++ )
+      items[i].type = SameSize( items[i], items[i - 1] ) ? items[i - 1].type : i;
+
+    // One branch per distinct pair of first contents
+    std::vector<Branch> branches;
+    for( int i = 0; i < (int)items.size(); i++ ) {
+
+      if( items[i].type != i )
+        continue;
+
+      Branch branch = { i, -1, 0, 0 };
+      for( int j = 0; j < (int)items.size(); j++ ) {
+
+        // First unplaced of its size
+        if( j == i || (items[j].type != j && !(items[j].type == i && j == i + 1)) )
+          continue;
+
+        branch.second = j;
+        if( items[i].w + items[j].w <= w ) {
+          branch.x = items[i].w; branch.y = 0;
+          branches.push_back( branch );
+        }
+        if( items[i].h + items[j].h <= h ) {
+          branch.x = 0; branch.y = items[i].h;
+          branches.push_back( branch );
+        }
+      }
+
+      // A single content
+      if( items.size() == 1 )
+        branches.push_back( branch );
+    }
+
+    deadline = std::chrono::steady_clock::now() + std::chrono::microseconds( (long long)(seconds * 1e6) );
+    nextBranch = 0;
+    found = false;
+    timedOut = false;
+    solution.clear();
+
+    threads = std::max( 1u, std::min( threads, (unsigned)branches.size() ) );
+    std::vector<std::thread> workers;
+    for( unsigned i = 1; i < threads; i++ )
+      workers.push_back( std::thread( &ExactCanvas::Work, this, std::cref( branches ), area ) );
+    Work( branches, area );
+    for( std::vector<std::thread>::iterator itor = workers.begin(); itor != workers.end(); itor++ )
+      itor->join();
+
+    if( !found )
+      return timedOut ? UNKNOWN : INFEASIBLE;
+
+    for( int i = 0; i < (int)order.size(); i++ ) {
+
+      Content<_T> content = contents[order[i]];
+      content.coord = Coord( solution[i].x, solution[i].y );
+      contentVector.push_back( content );
+    }
+
+    return FOUND;
+  }
+
+  const typename Content<_T>::Vector &GetContents( ) const {
+
+    return contentVector;
+  }
+
+  bool CollectContent( ContentAccumulator<_T> &content ) const {
+
+    content.Get().insert( content.Get().end(), contentVector.begin(), contentVector.end() );
+    return true;
+  }
+
+private:
+
+  struct Item {
+
+    int w;
+    int h;
+    long area;
+    int type; // Index of the first item of this size
+  };
+
+  // First two placements of a search
+  struct Branch {
+
+    int first;
+    int second; // -1 for none
+    int x;
+    int y;
+  };
+
+  struct Placed {
+
+    int x;
+    int y;
+  };
+
+  struct LargestFirst {
+
+    const std::vector<Item> &items;
+
+    LargestFirst( const std::vector<Item> &items ) : items( items ) {}
+
+    bool operator()( int a, int b ) const {
+
+      if( items[a].area != items[b].area ) return items[a].area > items[b].area;
+      if( items[a].w != items[b].w ) return items[a].w > items[b].w;
+      return items[a].h > items[b].h;
+    }
+  };
+
+  static bool SameSize( const Item &a, const Item &b ) {
+
+    return a.w == b.w && a.h == b.h;
+  }
+
+  // State of one worker thread
+  struct Search {
+
+    uint64_t left;         // Items not placed yet
+    long leftArea;
+    std::vector<Placed> placed;
+    std::vector<int> ex;   // Right edge of each placed item, -1 when not placed
+    std::vector<int> ey;   // Bottom edge
+    std::unordered_set<std::string> seen; // Staircases and contents left already searched
+    long nodes;
+  };
+
+  std::vector<Item> items;
+  std::chrono::steady_clock::time_point deadline;
+  std::atomic<int> nextBranch;
+  std::atomic<bool> found;
+  std::atomic<bool> timedOut;
+  std::mutex solutionMutex;
+  std::vector<Placed> solution;
+  typename Content<_T>::Vector contentVector;
+
+  static const std::size_t maxSeen = 1 << 20;
+
+  void Work( const std::vector<Branch> &branches, long area ) {
+
+    // The searched states stay valid from a branch to the next
+    Search search;
+    search.nodes = 0;
+
+    while( !found && !timedOut ) {
+
+      int branch = nextBranch++;
+      if( branch >= (int)branches.size() )
+        return;
+
+      search.left = items.size() == 64 ? ~(uint64_t)0 : ((uint64_t)1 << items.size()) - 1;
+      search.leftArea = area;
+      search.placed.resize( items.size() );
+      search.ex.assign( items.size(), -1 );
+      search.ey.assign( items.size(), -1 );
+
+      Put( search, branches[branch].first, 0, 0 );
+      if( branches[branch].second >= 0 )
+        Put( search, branches[branch].second, branches[branch].x, branches[branch].y );
+      if( Step( search ) ) {
+
+        std::lock_guard<std::mutex> lock( solutionMutex );
+        if( !found ) {
+          solution = search.placed;
+          found = true;
+        }
+      }
+    }
+  }
+
+  // Left and the first of its size left, same sized items are placed in order
+  bool Candidate( const Search &search, int i ) const {
+
+    if( !(search.left >> i & 1) )
+      return false;
+
+    return items[i].type == i || !(search.left >> (i - 1) & 1);
+  }
+
+  void Put( Search &search, int i, int x, int y ) {
+
+    search.placed[i].x = x;
+    search.placed[i].y = y;
+    search.ex[i] = x + items[i].w;
+    search.ey[i] = y + items[i].h;
+    search.left &= ~((uint64_t)1 << i);
+    search.leftArea -= items[i].area;
+  }
+
+  void Take( Search &search, int i ) {
+
+    search.ex[i] = -1;
+    search.ey[i] = -1;
+    search.left |= (uint64_t)1 << i;
+    search.leftArea += items[i].area;
+  }
+
+  // Corner points of the staircase and the area under it
+  void Corners( const Search &search, std::vector<Coord> &corners, long &area ) const {
+
+    // Right edges, sorted, with the lowest bottom edge right of each
+    std::vector< std::pair<int, int> > edges;
+    for( int i = 0; i < (int)items.size(); i++ )
+      if( search.ex[i] >= 0 )
+        edges.push_back( std::make_pair( search.ex[i], search.ey[i] ) );
+    std::sort( edges.begin(), edges.end() );
+
+    corners.clear();
+    area = 0;
+
+    int x = 0;
+
+    // Walk left to right, the staircase height over [x, edge) is the tallest item ending at or after edge
+    std::vector<int> suffix( edges.size() + 1, 0 );
+    for( int i = (int)edges.size() - 1; i >= 0; i-- ) suffix[i] = std::max( suffix[i + 1], edges[i].second );
+
+    corners.push_back( Coord( 0, suffix[0] ) );
+    for( int i = 0; i < (int)edges.size(); i++ ) {
+
+      area += (long)(edges[i].first - x) * suffix[i];
+      x = edges[i].first;
+
+      if( suffix[i + 1] < suffix[i] && x < w )
+        corners.push_back( Coord( x, suffix[i + 1] ) );
+    }
+  }
+
+  bool Step( Search &search ) {
+
+    if( !search.left )
+      return true;
+
+    if( (++search.nodes & 1023) == 0 && std::chrono::steady_clock::now() > deadline )
+      timedOut = true;
+
+    if( found || timedOut )
+      return false;
+
+    std::vector<Coord> corners;
+    long area;
+    Corners( search, corners, area );
+
+    if( search.leftArea > (long)w * h - area )
+      return false;
+
+    // Every remaining item needs a corner, later corners are never roomier
+    for( int i = 0; i < (int)items.size(); i++ ) {
+
+      if( !Candidate( search, i ) )
+        continue;
+
+      bool fits = false;
+      for( std::vector<Coord>::const_iterator corner = corners.begin(); corner != corners.end() && !fits; corner++ )
+        fits = corner->x + items[i].w <= w && corner->y + items[i].h <= h;
+
+      if( !fits )
+        return false;
+    }
+
+    // The remaining items and the staircase decide what follows
+    std::string key( (const char *)&search.left, sizeof(search.left) );
+    key.append( (const char *)&corners[0], corners.size() * sizeof(Coord) );
+    if( !search.seen.insert( key ).second )
+      return false;
+    if( search.seen.size() > maxSeen )
+      search.seen.clear();
+
+    for( int i = 0; i < (int)items.size(); i++ ) {
+
+      if( !Candidate( search, i ) )
+        continue;
+
+      for( std::vector<Coord>::const_iterator corner = corners.begin(); corner != corners.end(); corner++ ) {
+
+        if( corner->x + items[i].w > w || corner->y + items[i].h > h )
+          continue;
+
+        Put( search, i, corner->x, corner->y );
+        if( Step( search ) )
+          return true;
+        Take( search, i );
+
+        if( found || timedOut )
+          return false;
+      }
+    }
+
+    return false;
+  }
+};
+
+} /*** BinPack2D ***/
@@ -0,0 +1,270 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+
+/**
+ * MaskCanvas packs shapes instead of rectangles. Each content comes with an occupancy Mask, one
+ * bit per cell of 'cellSize' x 'cellSize' texels, and contents may overlap as long as no cell is
+ * used twice. Transparent corners of round or L-shaped images can then hold other images.
+ *
+ * Rows of cells are bitsets of 64-bit words. For a candidate row y the canvas computes, for every
+ * x at once, whether the mask collides: each run of set bits in a mask row blocks the x where the
+ * canvas row has a used cell within the run, a few shifts and ORs over the row. The first row
+ * with a free x wins (top-left first fit).
+ *
+ * Coordinates and sizes of the placed contents are in texels, always on the cell grid.
+ *
+ * EXAMPLE:
+ *
+ *   BinPack2D::Mask mask(3, 2);   // 3x2 cells
+ *   mask.Set(0, 0); mask.Set(1, 0); mask.Set(0, 1);
+ *
+ *   BinPack2D::MaskCanvas<MyContent> canvas(1024, 1024, 4);
+ *   if( !canvas.Place( BinPack2D::Content<MyContent>( mycontent, BinPack2D::Coord(), BinPack2D::Size(12, 8), false ), mask ) )
+ *     ... // full
+ */
+
+
+#pragma once
+
+#include "binpack2d.hpp"
+
+#include<vector>
+#include<stdint.h>
+
+namespace BinPack2D {
+
+class Mask {
+
+public:
+
+  const int w; // In cells
+  const int h;
+  const int words; // Per row
+
+  Mask( int w, int h )
+    : w(w),
+      h(h),
+      words((w + 63) / 64),
+      bits(words * h, 0)
+  {}
+
+  void Set( int x, int y ) {
+
+    bits[y * words + x / 64] |= (uint64_t)1 << (x % 64);
+  }
+
+  bool Get( int x, int y ) const {
+
+    return (bits[y * words + x / 64] >> (x % 64)) & 1;
+  }
+
+  const uint64_t *Row( int y ) const {
+
+    return &bits[y * words];
+  }
+
+  int Count() const {
+
+    int count = 0;
+    for( std::vector<uint64_t>::const_iterator itor = bits.begin(); itor != bits.end(); itor++ )
+      count += __builtin_popcountll( *itor );
+    return count;
+  }
+
+private:
+
+  std::vector<uint64_t> bits;
+};
+
+template<typename _T> class MaskCanvas {
+
+public:
+
+  const int w;
+  const int h;
+  const int cellSize;
+
+  MaskCanvas( int w, int h, int cellSize )
+    : w(w),
+      h(h),
+      cellSize(cellSize),
+      columns(w / cellSize),
+      rows(h / cellSize),
+      words((columns + 63) / 64),
+      used(words * rows, 0),
+      freeCells(rows, columns)
+  {}
+
+  // 'content.size' is in texels, 'mask' covers it in cells. Sets content.coord when it fits.
+  bool Place( Content<_T> content, const Mask &mask ) {
+
+    if( mask.w > columns || mask.h > rows )
+      return false;
+
+    // Runs of set cells in each mask row
+    std::vector< std::vector< std::pair<int, int> > > runs( mask.h );
+    for( int y = 0; y < mask.h; y++ ) {
+      for( int x = 0; x < mask.w; ) {
+        if( !mask.Get( x, y ) ) { x++; continue; }
+        int start = x;
+        while( x < mask.w && mask.Get( x, y ) ) x++;
+        runs[y].push_back( std::make_pair( start, x - start ) );
+      }
+    }
+
+    // x past columns - mask.w can't hold the mask
+    std::vector<uint64_t> outside( words, 0 );
+    for( int x = columns - mask.w + 1; x < words * 64; x++ ) outside[x / 64] |= (uint64_t)1 << (x % 64);
+
+    std::vector<uint64_t> blocked( words );
+    std::vector<uint64_t> smear( words );
+    std::vector<uint64_t> shifted( words );
+
+    for( int y = 0; y + mask.h <= rows; y++ ) {
+
+      blocked = outside;
+      bool full = false;
+
+      for( int row = 0; row < mask.h && !full; row++ ) {
+
+        if( runs[row].empty() )
+          continue;
+
+        if( freeCells[y + row] == 0 ) {
+          full = true;
+          break;
+        }
+
+        const uint64_t *canvasRow = &used[(y + row) * words];
+
+        for( std::vector< std::pair<int, int> >::const_iterator run = runs[row].begin(); run != runs[row].end(); run++ ) {
+
+          // smear bit x: a used cell in [x, x + length)
+          for( int i = 0; i < words; i++ ) smear[i] = canvasRow[i];
+          for( int covered = 1; covered < run->second; ) {
+            int step = std::min( covered, run->second - covered );
+            ShiftRight( smear, step, shifted );
+            for( int i = 0; i < words; i++ ) smear[i] |= shifted[i];
+            covered += step;
+          }
+
+          // Placed at x, the run starts at x + start
+          ShiftRight( smear, run->first, shifted );
+          for( int i = 0; i < words; i++ ) blocked[i] |= shifted[i];
+        }
+
+        full = true;
+        for( int i = 0; i < words && full; i++ ) full = blocked[i] == ~(uint64_t)0;
+      }
+
+      if( full )
+        continue;
+
+      for( int i = 0; i < words; i++ ) {
+        if( blocked[i] == ~(uint64_t)0 )
+          continue;
+
+        int x = i * 64 + __builtin_ctzll( ~blocked[i] );
+
+        Use( mask, x, y );
+        content.coord = Coord( x * cellSize, y * cellSize );
+        contentVector.push_back( content );
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  bool HasContent() const {
+
+    return ( contentVector.size() > 0 );
+  }
+
+  const typename Content<_T>::Vector &GetContents( ) const {
+
+    return contentVector;
+  }
+
+  // Used cells over all cells
+  float Occupancy() const {
+
+    int free = 0;
+    for( std::vector<int>::const_iterator itor = freeCells.begin(); itor != freeCells.end(); itor++ )
+      free += *itor;
+    return rows && columns ? 1.0f - (float)free / (rows * columns) : 0.0f;
+  }
+
+  bool CollectContent( ContentAccumulator<_T> &content ) const {
+
+    content.Get().insert( content.Get().end(), contentVector.begin(), contentVector.end() );
+    return true;
+  }
+
+private:
+
+  int columns;
+  int rows;
+  int words;
+  std::vector<uint64_t> used;
+  std::vector<int> freeCells; // Per row
+  typename Content<_T>::Vector contentVector;
+
+  // out bit x = in bit x + count
+  void ShiftRight( const std::vector<uint64_t> &in, int count, std::vector<uint64_t> &out ) const {
+
+    int wordShift = count / 64;
+    int bitShift = count % 64;
+
+    for( int i = 0; i < words; i++ ) {
+      uint64_t low = i + wordShift < words ? in[i + wordShift] : 0;
+      uint64_t high = i + wordShift + 1 < words ? in[i + wordShift + 1] : 0;
+      out[i] = bitShift ? (low >> bitShift) | (high << (64 - bitShift)) : low;
+    }
+  }
+
+  void Use( const Mask &mask, int x, int y ) {
+
+    int wordShift = x / 64;
+    int bitShift = x % 64;
+
+    for( int row = 0; row < mask.h; row++ ) {
+
+      const uint64_t *maskRow = mask.Row( row );
+      uint64_t *canvasRow = &used[(y + row) * words];
+
+      for( int i = 0; i < mask.words; i++ ) {
+        if( !maskRow[i] ) continue;
+
+        freeCells[y + row] -= __builtin_popcountll( maskRow[i] );
+
+        canvasRow[i + wordShift] |= maskRow[i] << bitShift;
+        if( bitShift && i + wordShift + 1 < words )
+          canvasRow[i + wordShift + 1] |= maskRow[i] >> (64 - bitShift);
+      }
+    }
+  }
+};
+
+} /*** BinPack2D ***/
@@ -0,0 +1,171 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+
+
+/**
+ * VerifyLayout checks the output of a packer: every content inside its canvas and no two contents
+ * of a canvas overlapping. In O(n log n), for layouts too large to test every pair of contents:
+ *
+ *   - The contents of each canvas are swept left to right, a content enters at its x and leaves
+ *     at its x + w (leaving first where one ends and another starts, rectangles are half open).
+ *   - The contents crossing the sweep line are kept by y. They don't overlap each other, so a
+ *     content entering overlaps one of them only if it overlaps its neighbour above or below.
+ *   - A content entering over another is reported with it and left out of the sweep, the
+ *     contents after it are still checked against the others.
+ *
+ * Empty contents overlap nothing, they are only checked to be inside their canvas.
+ *
+ * EXAMPLE:
+ *
+ *   canvasArray.CollectContent( outputContent );
+ *
+ *   std::vector<BinPack2D::LayoutError> errors;
+ *   if( !BinPack2D::VerifyLayout<MyContent>( outputContent.Get(), 1024, 1024, 4, errors ) )
+ *     printf( "content %d overlaps %d\n", errors[0].index, errors[0].other );
+ */
+
+
+#pragma once
+
+#include "binpack2d.hpp"
+
+#include<vector>
+#include<map>
+#include<algorithm>
+
+namespace BinPack2D {
+
+// A content out of its canvas (other is -1), or overlapping 'other'. Indices in the verified vector.
+class LayoutError {
+  
+public:
+  
+  int index;
+  int other;
+  
+  LayoutError( int index, int other )
+    : index(index),
+      other(other)
+  {}
+};
+
+namespace Verify {
+
+struct Event {
+  
+  int x;
+  bool enter;
+  int index;
+  
+  bool operator < ( const Event &that ) const {
+    
+    if( this->x != that.x ) return this->x < that.x;
+    if( this->enter != that.enter ) return !this->enter;
+    return this->index < that.index;
+  }
+};
+
+} /*** Verify ***/
+
+// Canvases are w by h, d of them. Returns true when 'errors' got nothing.
+template<typename _T> bool VerifyLayout( const typename Content<_T>::Vector &contentVector, int w, int h, int d,
+                                         std::vector<LayoutError> &errors ) {
+  
+  std::size_t errorCount = errors.size();
+  std::vector< std::vector<Verify::Event> > canvasEvents( std::max( d, 0 ) );
+  
+  for( int i = 0; i < (int)contentVector.size(); i++ ) {
+    
+    const Content<_T> &content = contentVector[i];
+    const Coord &coord = content.coord;
+    const Size &size = content.size;
+    
+    if( coord.x < 0 || coord.y < 0 || coord.z < 0 || coord.z >= d || size.w < 0 || size.h < 0 ||
+	coord.x > w - size.w || coord.y > h - size.h ) {
+      
+      errors.push_back( LayoutError( i, -1 ) );
+      continue;
+    }
+    
+    if( size.w == 0 || size.h == 0 )
+      continue;
+    
+    Verify::Event enter = { coord.x, true, i };
+    Verify::Event leave = { coord.x + size.w, false, i };
+    canvasEvents[coord.z].push_back( enter );
+    canvasEvents[coord.z].push_back( leave );
+  }
+  
+  for( int z = 0; z < (int)canvasEvents.size(); z++ ) {
+    
+    std::vector<Verify::Event> &events = canvasEvents[z];
+    std::sort( events.begin(), events.end() );
+    
+    // Contents crossing the sweep line, by their top
+    std::map<int, int> crossing;
+    
+    for( std::vector<Verify::Event>::const_iterator itor = events.begin(); itor != events.end(); itor++ ) {
+      
+      const Content<_T> &content = contentVector[itor->index];
+      int top = content.coord.y;
+      int bottom = content.coord.y + content.size.h;
+      
+      if( !itor->enter ) {
+	
+	// Not there if it was left out for overlapping
+	std::map<int, int>::iterator found = crossing.find( top );
+	if( found != crossing.end() && found->second == itor->index )
+	  crossing.erase( found );
+	continue;
+      }
+      
+      std::map<int, int>::iterator below = crossing.lower_bound( top );
+      
+      if( below != crossing.end() && below->first < bottom ) {
+	
+	errors.push_back( LayoutError( itor->index, below->second ) );
+	continue;
+      }
+      
+      if( below != crossing.begin() ) {
+	
+	std::map<int, int>::iterator above = below;
+	above--;
+	
+	const Content<_T> &that = contentVector[above->second];
+	if( that.coord.y + that.size.h > top ) {
+	  
+	  errors.push_back( LayoutError( itor->index, above->second ) );
+	  continue;
+	}
+      }
+      
+      crossing.insert( below, std::make_pair( top, itor->index ) );
+    }
+  }
+  
+  return errors.size() == errorCount;
+}
+
+} /*** BinPack2D ***/
@@ -1,2 +1,11 @@
 #!/bin/sh
-g++ -O3 -lfreeimage gorilla_binpacker.cpp -o gorilla_binpacker
+g++ -O3 gorilla_binpacker.cpp -o gorilla_binpacker -lfreeimage -lz -pthread
+g++ -O3 gorilla_bench.cpp -o gorilla_bench -lfreeimage -lz -pthread
+
+# libgorilla_binpacker, only the gorilla_api.h functions are exported
+g++ -O3 -fPIC -fvisibility=hidden -c gorilla_api.cpp -o gorilla_api.o
+ar rcs libgorilla_binpacker.a gorilla_api.o
+g++ -shared -O3 -fPIC -fvisibility=hidden gorilla_api.cpp -o libgorilla_binpacker.so -lfreeimage -lz -pthread
+
+# Pack server on a Unix socket, built on the library
+g++ -O3 gorilla_server.cpp -o gorilla_server libgorilla_binpacker.a -lfreeimage -lz -pthread
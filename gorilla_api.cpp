@@ -0,0 +1,383 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "gorilla_api.h"
+
+#include "binpack2d.hpp"
+#include "gorilla_atlas.hpp"
+#include "gorilla_font.hpp"
+#include "gorilla_image.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <string.h>
+
+
+// Same as the tool, none of its globals are used: every atlas holds its own state.
+static const unsigned WHITEPIXEL_SIZE = 3;
+static const int WHITEPIXEL = -1; // Index of the whitepixel, the others are image indices
+
+
+struct InputImage
+{
+    std::string name;
+    RgbaImage pixels;
+    std::shared_ptr<GorillaFontParser> font;
+};
+
+
+// An image of the atlas as the build steps shared with the tool (gorilla_atlas.hpp) pack it
+class AtlasImage
+{
+public:
+    AtlasImage(const std::vector<InputImage>& images, int index) : mImages(&images), mIndex(index) {}
+
+    int getIndex() const { return mIndex; }
+    bool isWhitepixel() const { return mIndex == WHITEPIXEL; }
+    unsigned getWidth() const { return isWhitepixel() ? WHITEPIXEL_SIZE : getImage().pixels.getWidth(); }
+    unsigned getHeight() const { return isWhitepixel() ? WHITEPIXEL_SIZE : getImage().pixels.getHeight(); }
+    std::string getSpriteName() const { return getImage().name; }
+    bool isFont() const { return !isWhitepixel() && getImage().font; }
+    bool isGlyph() const { return false; }
+    int getGlyphCode() const { return 0; }
+    GorillaFontParser* getFontParser() const { return isWhitepixel() ? NULL : getImage().font.get(); }
+    const std::string& getGroup() const { static const std::string none; return none; }
+    const BinPack2D::Mask* getMask() const { return NULL; }
+
+protected:
+    const InputImage& getImage() const { return (*mImages)[mIndex]; }
+
+    const std::vector<InputImage>* mImages; // The atlas's, images added after packing are not reached
+    int mIndex;
+};
+
+
+struct gorilla_atlas
+{
+    std::mutex mutex;
+    gorilla_options options;
+    std::vector<InputImage> images;
+    RgbaImage whitepixel;
+    std::string error;
+
+    // From the last successful gorilla_atlas_pack()
+    bool packed;
+    unsigned width;
+    unsigned height;
+    unsigned pages;
+    std::vector<gorilla_placement> placements;
+    std::vector<BinPack2D::ContentAccumulator<AtlasImage> > pageContent;
+    std::vector<std::vector<unsigned char> > pageTexels; // Composited when first asked for
+};
+
+
+namespace
+{
+
+AtlasOptions getAtlasOptions(const gorilla_options& options)
+{
+    AtlasOptions atlasOptions;
+    atlasOptions.gutter = options.gutter;
+    atlasOptions.blockAlign = std::max(1u, options.block_align);
+    atlasOptions.pages = std::max(1u, options.max_pages);
+    return atlasOptions;
+}
+
+
+void addImage(gorilla_atlas* atlas, const char* name, unsigned width, unsigned height, const unsigned char* rgba, size_t stride,
+              const std::shared_ptr<GorillaFontParser>& font)
+{
+    if (!name || !rgba || !width || !height) throw std::runtime_error("Image without name or pixels");
+    if (!stride) stride = (size_t)width * 4;
+    if (stride < (size_t)width * 4) throw std::runtime_error(std::string("Stride shorter than a row:")+name);
+
+    // A font sheet is cropped to its glyphs, like the tool does
+    unsigned w = font ? font->getWidth() : width;
+    unsigned h = font ? font->getHeight() : height;
+    if (!w || !h || w > width || h > height) throw std::runtime_error(std::string("Glyphs outside of font image:")+name);
+
+    InputImage image;
+    image.name = stripExtension(stripPath(name));
+    image.pixels = RgbaImage(w, h);
+    image.font = font;
+    for (unsigned y = 0; y < h; y++) memcpy(image.pixels.getRow(y), rgba + y * stride, (size_t)w * 4);
+
+    atlas->images.push_back(image);
+    atlas->packed = false;
+}
+
+
+// Packed at the smallest size holding every image, as the tool packs
+void pack(gorilla_atlas* atlas)
+{
+    atlas->packed = false;
+
+    const gorilla_options& options = atlas->options;
+    if (!options.min_size || options.min_size > options.max_size) throw std::runtime_error("Page sizes out of order");
+
+    AtlasOptions atlasOptions = getAtlasOptions(options);
+
+    BinPack2D::ContentAccumulator<AtlasImage> inputContent;
+    for (std::size_t i = 0; i <= atlas->images.size(); i++)
+    {
+        AtlasImage image(atlas->images, i == atlas->images.size() ? WHITEPIXEL : (int)i);
+        inputContent += BinPack2D::Content<AtlasImage>(image, BinPack2D::Coord(),
+            getPackedSize(atlasOptions, image.getWidth(), image.getHeight()), false);
+    }
+
+    // Sort the input content by size... usually packs better.
+    inputContent.Sort();
+
+    bool found = searchAtlasSize(options.min_size, options.max_size, [&](unsigned width, unsigned height)
+    {
+        BinPack2D::ContentAccumulator<AtlasImage> outputContent;
+        BinPack2D::ContentAccumulator<AtlasImage> remainder;
+        AtlasPlaceReport report;
+        placeAtlas(inputContent, width, height, atlasOptions, outputContent, remainder, report);
+        if (!remainder.Get().empty()) return false;
+
+        atlas->width = width;
+        atlas->height = height;
+        atlas->pages = getPageCount(outputContent);
+        atlas->pageContent = splitPages(outputContent, atlas->pages);
+        atlas->placements.assign(atlas->images.size(), gorilla_placement());
+
+        for (BinPack2D::Content<AtlasImage>::Vector::const_iterator itor = outputContent.Get().begin(); itor != outputContent.Get().end(); itor++)
+        {
+            if (itor->content.isWhitepixel()) continue;
+
+            gorilla_placement& placement = atlas->placements[itor->content.getIndex()];
+            placement.page = itor->coord.z;
+            placement.x = itor->coord.x + atlasOptions.gutter;
+            placement.y = itor->coord.y + atlasOptions.gutter;
+            placement.width = itor->content.getWidth();
+            placement.height = itor->content.getHeight();
+        }
+        return true;
+    });
+
+    if (!found) throw std::runtime_error("Images don't fit in the largest page");
+
+    atlas->pageTexels.assign(atlas->pages, std::vector<unsigned char>());
+    atlas->packed = true;
+}
+
+
+void composite(gorilla_atlas* atlas, unsigned page)
+{
+    std::vector<unsigned char>& texels = atlas->pageTexels[page];
+    AtlasOptions atlasOptions = getAtlasOptions(atlas->options);
+    std::size_t stride = (std::size_t)atlas->width * 4;
+    texels.assign(stride * atlas->height, 0);
+
+    const BinPack2D::Content<AtlasImage>::Vector& contents = atlas->pageContent[page].Get();
+    for (BinPack2D::Content<AtlasImage>::Vector::const_iterator itor = contents.begin(); itor != contents.end(); itor++)
+    {
+        const RgbaImage& pixels = itor->content.isWhitepixel() ? atlas->whitepixel : atlas->images[itor->content.getIndex()].pixels;
+        compositeRows(pixels, itor->coord.x + atlasOptions.gutter, itor->coord.y + atlasOptions.gutter, NULL, atlasOptions, 0, atlas->height,
+                      [&](unsigned row) { return &texels[row * stride]; }, false);
+    }
+}
+
+
+// Copies as snprintf does, the pointers the atlas holds change on the next call from any thread
+std::size_t copyText(const std::string& text, char* buffer, std::size_t size)
+{
+    if (buffer && size)
+    {
+        std::size_t count = std::min(text.size(), size - 1);
+        memcpy(buffer, text.data(), count);
+        buffer[count] = 0;
+    }
+    return text.size();
+}
+
+
+// Runs 'call' locked, exceptions become the atlas error
+template<typename Call>
+bool guarded(gorilla_atlas* atlas, Call call)
+{
+    if (!atlas) return false;
+
+    std::lock_guard<std::mutex> lock(atlas->mutex);
+    try
+    {
+        call();
+        atlas->error.clear();
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        atlas->error = e.what();
+    }
+    catch (...)
+    {
+        atlas->error = "Unknown error";
+    }
+    return false;
+}
+
+
+void checkPacked(gorilla_atlas* atlas)
+{
+    if (!atlas->packed) throw std::runtime_error("Atlas not packed");
+}
+
+} // namespace
+
+
+void gorilla_default_options(gorilla_options* options)
+{
+    options->gutter = 0;
+    options->block_align = 1;
+    options->min_size = 128;
+    options->max_size = 8192;
+    options->max_pages = 1;
+}
+
+
+gorilla_atlas* gorilla_atlas_create(const gorilla_options* options)
+{
+    gorilla_atlas* atlas = new (std::nothrow) gorilla_atlas();
+    if (!atlas) return NULL;
+
+    if (options) atlas->options = *options;
+    else gorilla_default_options(&atlas->options);
+
+    atlas->packed = false;
+    atlas->whitepixel = RgbaImage(WHITEPIXEL_SIZE, WHITEPIXEL_SIZE);
+    for (unsigned y = 0; y < WHITEPIXEL_SIZE; y++) memset(atlas->whitepixel.getRow(y), 0xff, WHITEPIXEL_SIZE * 4);
+
+    return atlas;
+}
+
+
+void gorilla_atlas_destroy(gorilla_atlas* atlas)
+{
+    delete atlas;
+}
+
+
+int gorilla_atlas_add_image(gorilla_atlas* atlas, const char* name, unsigned width, unsigned height,
+                            const unsigned char* rgba, size_t stride)
+{
+    int index = -1;
+    guarded(atlas, [&] {
+        addImage(atlas, name, width, height, rgba, stride, std::shared_ptr<GorillaFontParser>());
+        index = (int)atlas->images.size() - 1;
+    });
+    return index;
+}
+
+
+int gorilla_atlas_add_font(gorilla_atlas* atlas, const char* name, unsigned width, unsigned height,
+                           const unsigned char* rgba, size_t stride, const char* gorilla, size_t gorilla_size)
+{
+    int index = -1;
+    guarded(atlas, [&] {
+        if (!gorilla) throw std::runtime_error("Font without .gorilla text");
+        std::shared_ptr<GorillaFontParser> font = std::make_shared<GorillaFontParser>(gorilla, gorilla_size);
+        addImage(atlas, name, width, height, rgba, stride, font);
+        index = (int)atlas->images.size() - 1;
+    });
+    return index;
+}
+
+
+int gorilla_atlas_pack(gorilla_atlas* atlas)
+{
+    return guarded(atlas, [&] { pack(atlas); }) ? 0 : -1;
+}
+
+
+int gorilla_atlas_get_size(gorilla_atlas* atlas, unsigned* width, unsigned* height, unsigned* pages)
+{
+    return guarded(atlas, [&] {
+        checkPacked(atlas);
+        if (width) *width = atlas->width;
+        if (height) *height = atlas->height;
+        if (pages) *pages = atlas->pages;
+    }) ? 0 : -1;
+}
+
+
+int gorilla_atlas_get_placement(gorilla_atlas* atlas, int image, gorilla_placement* placement)
+{
+    return guarded(atlas, [&] {
+        checkPacked(atlas);
+        if (image < 0 || (std::size_t)image >= atlas->images.size()) throw std::runtime_error("No such image");
+        *placement = atlas->placements[image];
+    }) ? 0 : -1;
+}
+
+
+int gorilla_atlas_get_whitepixel(gorilla_atlas* atlas, unsigned* x, unsigned* y)
+{
+    return guarded(atlas, [&] {
+        checkPacked(atlas);
+        getWhitepixel(atlas->pageContent[0], atlas->options.gutter, *x, *y);
+    }) ? 0 : -1;
+}
+
+
+const unsigned char* gorilla_atlas_get_page(gorilla_atlas* atlas, unsigned page)
+{
+    const unsigned char* texels = NULL;
+    guarded(atlas, [&] {
+        checkPacked(atlas);
+        if (page >= atlas->pages) throw std::runtime_error("No such page");
+        if (atlas->pageTexels[page].empty()) composite(atlas, page);
+        texels = &atlas->pageTexels[page][0];
+    });
+    return texels;
+}
+
+
+size_t gorilla_atlas_get_gorilla(gorilla_atlas* atlas, unsigned page, const char* image_filename, char* buffer, size_t size)
+{
+    std::size_t length = 0;
+    guarded(atlas, [&] {
+        checkPacked(atlas);
+        if (page >= atlas->pages) throw std::runtime_error("No such page");
+        std::ostringstream file;
+        writeAtlasGorilla(file, atlas->pageContent[page], image_filename ? image_filename : "", atlas->options.gutter);
+        length = copyText(file.str(), buffer, size);
+    });
+    return length;
+}
+
+
+size_t gorilla_atlas_get_error(gorilla_atlas* atlas, char* buffer, size_t size)
+{
+    if (!atlas) return copyText("No atlas", buffer, size);
+
+    // Copied under the lock, the next call on the atlas replaces the message
+    std::lock_guard<std::mutex> lock(atlas->mutex);
+    return copyText(atlas->error, buffer, size);
+}
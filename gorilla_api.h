@@ -0,0 +1,128 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+/*
+ * C API of libgorilla_binpacker, packing in process from pixels in memory: no image file is read
+ * or written. Build the library with build.sh (libgorilla_binpacker.a and .so).
+ *
+ * An atlas takes RGBA images (fonts with their .gorilla text), finds the smallest page size
+ * holding them as the tool does, and returns where each image went, the composited pages and
+ * their .gorilla text. A whitepixel is added to every page.
+ *
+ * Calls on different atlases can run on any threads at the same time, nothing is shared between
+ * them. Calls on the same atlas are serialized by a lock. Returned pages stay valid until the next
+ * call changing the atlas (add, pack, destroy), text is copied into the caller's buffer.
+ *
+ * EXAMPLE:
+ *
+ *   gorilla_atlas* atlas = gorilla_atlas_create(NULL);
+ *   int hero = gorilla_atlas_add_image(atlas, "hero", 32, 48, heroPixels, 0);
+ *   char error[256];
+ *   if (gorilla_atlas_pack(atlas) != 0 && gorilla_atlas_get_error(atlas, error, sizeof(error))) puts(error);
+ *
+ *   gorilla_placement where;
+ *   gorilla_atlas_get_placement(atlas, hero, &where);
+ *   const unsigned char* page = gorilla_atlas_get_page(atlas, where.page);
+ *   size_t size = gorilla_atlas_get_gorilla(atlas, where.page, "atlas.png", NULL, 0);
+ *   char* gorilla = malloc(size + 1);
+ *   gorilla_atlas_get_gorilla(atlas, where.page, "atlas.png", gorilla, size + 1);
+ *   gorilla_atlas_destroy(atlas);
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+
+/* The library is built with hidden visibility, only these functions are exported */
+#define GORILLA_API __attribute__((visibility("default")))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct gorilla_atlas gorilla_atlas;
+
+typedef struct gorilla_options
+{
+    unsigned gutter;      /* Texels around each image, filled with its edge texels */
+    unsigned block_align; /* Packed sizes and positions are multiples of it, 4 for block compression */
+    unsigned min_size;    /* Smallest page side tried, a power of two */
+    unsigned max_size;    /* Packing fails past pages of this side */
+    unsigned max_pages;   /* Images are spread over up to this many pages */
+} gorilla_options;
+
+/* Where an image is, its gutter is around */
+typedef struct gorilla_placement
+{
+    unsigned page;
+    unsigned x, y;
+    unsigned width, height;
+} gorilla_placement;
+
+
+/* 0 gutter, no alignment, 128 to 8192 texels, one page */
+GORILLA_API void gorilla_default_options(gorilla_options* options);
+
+/* NULL options for the defaults. Returns NULL when out of memory. */
+GORILLA_API gorilla_atlas* gorilla_atlas_create(const gorilla_options* options);
+GORILLA_API void gorilla_atlas_destroy(gorilla_atlas* atlas);
+
+/* 'rgba' holds 'height' rows of 'width' texels, 8 bits per channel, top to bottom and 'stride' bytes
+ * apart (0 for width * 4). The pixels are copied. 'name' is written in the .gorilla, without its
+ * path and extension. Returns the image index, -1 on error. */
+GORILLA_API int gorilla_atlas_add_image(gorilla_atlas* atlas, const char* name, unsigned width, unsigned height,
+                                        const unsigned char* rgba, size_t stride);
+
+/* A font sheet and its .gorilla text, the sheet is cropped to the glyphs. */
+GORILLA_API int gorilla_atlas_add_font(gorilla_atlas* atlas, const char* name, unsigned width, unsigned height,
+                                       const unsigned char* rgba, size_t stride, const char* gorilla, size_t gorilla_size);
+
+/* Finds the smallest size holding every image. Returns 0 on success. */
+GORILLA_API int gorilla_atlas_pack(gorilla_atlas* atlas);
+
+/* Size and page count of the packed atlas */
+GORILLA_API int gorilla_atlas_get_size(gorilla_atlas* atlas, unsigned* width, unsigned* height, unsigned* pages);
+GORILLA_API int gorilla_atlas_get_placement(gorilla_atlas* atlas, int image, gorilla_placement* placement);
+
+/* Center of the whitepixel, at the same place on every page */
+GORILLA_API int gorilla_atlas_get_whitepixel(gorilla_atlas* atlas, unsigned* x, unsigned* y);
+
+/* Composited page, RGBA rows top to bottom, width * 4 bytes apart. NULL on error. */
+GORILLA_API const unsigned char* gorilla_atlas_get_page(gorilla_atlas* atlas, unsigned page);
+
+/* Text is copied into 'buffer' as snprintf does: cut to 'size' - 1 bytes and null terminated. The
+ * full length is returned, a NULL buffer and 0 size only measure it. */
+
+/* .gorilla text of a page, naming 'image_filename' as its texture. 0 on error. */
+GORILLA_API size_t gorilla_atlas_get_gorilla(gorilla_atlas* atlas, unsigned page, const char* image_filename,
+                                             char* buffer, size_t size);
+
+/* Why the last call on the atlas failed, a call from another thread can replace it. 0 when it didn't. */
+GORILLA_API size_t gorilla_atlas_get_error(gorilla_atlas* atlas, char* buffer, size_t size);
+
+
+#ifdef __cplusplus
+}
+#endif
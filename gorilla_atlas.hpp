@@ -0,0 +1,449 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include "binpack2d.hpp"
+#include "binpack2d_balanced.hpp"
+#include "binpack2d_mask.hpp"
+#include "gorilla_font.hpp"
+#include "gorilla_image.hpp"
+
+#include <algorithm>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Steps of an atlas build that only depend on their arguments: the size search, the placement,
+// compositing an image with its gutter and the .gorilla text. The tool and the library
+// (gorilla_api.h) share them, the options only the tool has are arguments here.
+//
+// Contents packed by these steps provide:
+//   bool isWhitepixel() const
+//   unsigned getWidth() const, getHeight() const       the image size, the gutter is around it
+//   std::string getSpriteName() const                  its name in [Sprites]
+//   bool isFont() const, isGlyph() const               a whole font sheet, or one glyph of it
+//   int getGlyphCode() const
+//   GorillaFontParser* getFontParser() const           NULL unless a font or a glyph
+//   const std::string& getGroup() const                empty when the image has no group
+//   const BinPack2D::Mask* getMask() const             set on every content when packing masks
+
+
+struct AtlasOptions
+{
+    AtlasOptions() : gutter(0), blockAlign(1), maskCell(0), pages(1), balance(false) {}
+
+    unsigned gutter;     // Texels reserved around each image
+    unsigned blockAlign; // Packed sizes are rounded up to a multiple of this
+    unsigned maskCell;   // Cell size of mask packing in texels, 0 packs rectangles
+    unsigned pages;      // Pages of the same size to spread the images over
+    bool balance;        // Deal the images evenly over the pages and fill them in parallel
+};
+
+
+// What placeAtlas() reports besides the placements
+struct AtlasPlaceReport
+{
+    AtlasPlaceReport() : occupancy(-1.0f) {}
+
+    float occupancy; // Of the cells of a mask canvas, -1 for rectangles
+    std::vector<std::pair<std::string, int> > spreads; // Pages holding each group
+};
+
+
+inline unsigned alignUp(unsigned size, unsigned align)
+{
+    return (size + align - 1) / align * align;
+}
+
+
+// Atlas sizes by increasing area: 128x128, 256x128, 128x256, 256x256, 512x256...
+inline void nextAtlasSize(unsigned& width, unsigned& height)
+{
+    if (width == height) width *= 2;
+    else if (width > height) std::swap(width, height);
+    else width = height;
+}
+
+
+// Space taken by an image of width x height with its gutter, aligned so every coordinate stays
+// aligned too (page sizes are powers of two)
+inline BinPack2D::Size getPackedSize(const AtlasOptions& options, unsigned width, unsigned height)
+{
+    return BinPack2D::Size(alignUp(width + 2 * options.gutter, options.blockAlign), alignUp(height + 2 * options.gutter, options.blockAlign));
+}
+
+
+// Tries minSize x minSize, then the larger sizes by increasing area, until 'packAt(width, height)'
+// returns true. False when no size up to maxSize does.
+template<typename PackAt>
+bool searchAtlasSize(unsigned minSize, unsigned maxSize, PackAt packAt)
+{
+    for (unsigned width = minSize, height = minSize; width <= maxSize && height <= maxSize; nextAtlasSize(width, height))
+    {
+        if (packAt(width, height)) return true;
+    }
+    return false;
+}
+
+
+// Places the sorted 'inputContent' on pages of width x height. Contents left out go to 'remainder'.
+//
+// With a mask cell, images nest in the transparent cells of others on a single page. Otherwise
+// groups are placed first, largest first, on as few pages as possible and the others fill the
+// gaps. Every page gets its own whitepixel, at the same place.
+template<typename T>
+void placeAtlas(const BinPack2D::ContentAccumulator<T>& inputContent, unsigned width, unsigned height, const AtlasOptions& options,
+                BinPack2D::ContentAccumulator<T>& outputContent, BinPack2D::ContentAccumulator<T>& remainder, AtlasPlaceReport& report)
+{
+    typedef typename BinPack2D::Content<T>::Vector ContentVector;
+    const ContentVector& contents = inputContent.Get();
+
+    if (options.maskCell)
+    {
+        BinPack2D::MaskCanvas<T> canvas(width, height, options.maskCell);
+        for (typename ContentVector::const_iterator itor = contents.begin(); itor != contents.end(); itor++)
+        {
+            if (!canvas.Place(*itor, *itor->content.getMask())) remainder += *itor;
+        }
+
+        canvas.CollectContent(outputContent);
+        report.occupancy = canvas.Occupancy();
+        return;
+    }
+
+    // Without rotation, .gorilla has no way to describe a rotated image.
+    BinPack2D::CanvasArray<T> canvasArray = BinPack2D::UniformCanvasArrayBuilder<T>(width, height, std::max(1u, options.pages), false).Build();
+
+    std::map<std::string, ContentVector> groups;
+    ContentVector ungrouped;
+    for (typename ContentVector::const_iterator itor = contents.begin(); itor != contents.end(); itor++)
+    {
+        if (options.pages > 1 && itor->content.isWhitepixel())
+        {
+            if (!canvasArray.Reserve(*itor)) remainder += *itor;
+        }
+        else if (itor->content.getGroup().empty()) ungrouped.push_back(*itor);
+        else groups[itor->content.getGroup()].push_back(*itor);
+    }
+
+    std::vector<std::pair<long, std::string> > groupOrder;
+    for (typename std::map<std::string, ContentVector>::const_iterator it = groups.begin(); it != groups.end(); it++)
+    {
+        long area = 0;
+        for (typename ContentVector::const_iterator itor = it->second.begin(); itor != it->second.end(); itor++)
+        {
+            area += (long)itor->size.w * itor->size.h;
+        }
+        groupOrder.push_back(std::make_pair(-area, it->first));
+    }
+    std::sort(groupOrder.begin(), groupOrder.end());
+
+    for (std::size_t i = 0; i < groupOrder.size(); i++)
+    {
+        canvasArray.PlaceGroup(groups[groupOrder[i].second], i, remainder.Get());
+    }
+
+    ContentVector left;
+    if (options.balance) BinPack2D::PlaceBalanced(canvasArray, ungrouped, left);
+    else canvasArray.Place(ungrouped, left);
+    remainder += left;
+
+    canvasArray.CollectContent(outputContent);
+
+    for (std::size_t i = 0; i < groupOrder.size(); i++)
+    {
+        report.spreads.push_back(std::make_pair(groupOrder[i].second, canvasArray.Spread(i)));
+    }
+}
+
+
+// Pages are filled in order, those past the last holding an image are left out
+template<typename T>
+unsigned getPageCount(const BinPack2D::ContentAccumulator<T>& outputContent)
+{
+    unsigned pageCount = 1;
+    for (typename BinPack2D::Content<T>::Vector::const_iterator itor = outputContent.Get().begin(); itor != outputContent.Get().end(); itor++)
+    {
+        if (!itor->content.isWhitepixel()) pageCount = std::max(pageCount, (unsigned)itor->coord.z + 1);
+    }
+    return pageCount;
+}
+
+
+template<typename T>
+std::vector<BinPack2D::ContentAccumulator<T> > splitPages(const BinPack2D::ContentAccumulator<T>& outputContent, unsigned pageCount)
+{
+    std::vector<BinPack2D::ContentAccumulator<T> > pageContent(pageCount);
+    for (typename BinPack2D::Content<T>::Vector::const_iterator itor = outputContent.Get().begin(); itor != outputContent.Get().end(); itor++)
+    {
+        if ((unsigned)itor->coord.z < pageCount) pageContent[itor->coord.z] += *itor;
+    }
+    return pageContent;
+}
+
+
+// Texels [x0, x1) of row 'row' of the image with its gutter, edge texels repeated.
+// Written in RGBA, or in FreeImage's BGRA when 'bgra' is set.
+inline void copyPaddedSpan(const RgbaImage& src, unsigned gutter, unsigned row, unsigned x0, unsigned x1, BYTE* dst, bool bgra)
+{
+    const BYTE* line = src.getRow(row < gutter ? 0 : std::min(row - gutter, src.getHeight() - 1));
+
+    for (unsigned x = x0; x < x1; x++, dst += 4)
+    {
+        const BYTE* texel = line + (x < gutter ? 0 : std::min(x - gutter, src.getWidth() - 1)) * 4;
+        if (bgra)
+        {
+            dst[FI_RGBA_RED] = texel[0];
+            dst[FI_RGBA_GREEN] = texel[1];
+            dst[FI_RGBA_BLUE] = texel[2];
+            dst[FI_RGBA_ALPHA] = texel[3];
+        }
+        else memcpy(dst, texel, 4);
+    }
+}
+
+
+// Row 'row' of the image with its gutter, in RGBA. 'dst' is where the image row starts, the
+// gutter goes on both sides of it.
+inline void copyPaddedRow(const RgbaImage& src, unsigned gutter, unsigned row, BYTE* dst)
+{
+    unsigned w = src.getWidth();
+    const BYTE* line = src.getRow(row < gutter ? 0 : std::min(row - gutter, src.getHeight() - 1));
+
+    for (unsigned i = 1; i <= gutter; i++)
+    {
+        memcpy(dst - i * 4, line, 4);
+        memcpy(dst + (w - 1 + i) * 4, line + (w - 1) * 4, 4);
+    }
+    memcpy(dst, line, w * 4);
+}
+
+
+// Composites the rows [y0, y1) of the page crossed by an image at (x, y) and its gutter, the gutter
+// repeating the edge texels so filtering samples the image instead of its neighbour. With a mask
+// only the owned cells are written, neighbours may nest in the bounding box. 'rowOf(row)' is where
+// page row 'row' starts, in RGBA or in FreeImage's BGRA when 'bgra' is set.
+// Returns the row past the last one the image covers.
+template<typename RowOf>
+unsigned compositeRows(const RgbaImage& pixels, unsigned x, unsigned y, const BinPack2D::Mask* mask, const AtlasOptions& options,
+                       unsigned y0, unsigned y1, RowOf rowOf, bool bgra)
+{
+    unsigned gutter = options.gutter;
+    unsigned cell = options.maskCell;
+    unsigned end = mask ? y - gutter + mask->h * cell : y + pixels.getHeight() + gutter;
+    if (!pixels.getWidth() || !pixels.getHeight()) return end;
+
+    unsigned top = std::max(y0, y - gutter);
+    unsigned bottom = std::min(y1, end);
+
+    for (unsigned row = top; mask && row < bottom; row++)
+    {
+        unsigned maskRow = row - (y - gutter);
+        BYTE* dst = rowOf(row) + (x - gutter) * 4;
+
+        for (int cx = 0; cx < mask->w; )
+        {
+            if (!mask->Get(cx, maskRow / cell)) { cx++; continue; }
+            int start = cx;
+            while (cx < mask->w && mask->Get(cx, maskRow / cell)) cx++;
+
+            copyPaddedSpan(pixels, gutter, maskRow, start * cell, cx * cell, dst + start * cell * 4, bgra);
+        }
+    }
+
+    for (unsigned row = top; !mask && row < bottom; row++)
+    {
+        if (bgra) copyPaddedSpan(pixels, gutter, row - (y - gutter), 0, pixels.getWidth() + 2 * gutter, rowOf(row) + (x - gutter) * 4, true);
+        else copyPaddedRow(pixels, gutter, row - (y - gutter), rowOf(row) + x * 4);
+    }
+
+    return end;
+}
+
+
+// [Sprites] line of an image at (x, y) in the atlas
+inline void appendGorillaSprite(std::ostream& file, const std::string& name, unsigned x, unsigned y, unsigned w, unsigned h)
+{
+    file << name << " ";
+    file << x << " ";
+    file << y << " ";
+    file << w << " ";
+    file << h << " ";
+    file << std::endl;
+}
+
+
+// Center of the whitepixel of a page
+template<typename T>
+void getWhitepixel(const BinPack2D::ContentAccumulator<T>& pageContent, unsigned gutter, unsigned& x, unsigned& y)
+{
+    for (typename BinPack2D::Content<T>::Vector::const_iterator itor = pageContent.Get().begin(); itor != pageContent.Get().end(); itor++)
+    {
+        if (itor->content.isWhitepixel())
+        {
+            x = itor->coord.x + gutter + itor->content.getWidth()/2;
+            y = itor->coord.y + gutter + itor->content.getHeight()/2;
+            return;
+        }
+    }
+
+    throw std::runtime_error("Where is the whitepixel?");
+}
+
+
+// Where a font went: its sheet position, or the position of each glyph when they were split.
+struct PlacedFont
+{
+    GorillaFontParser* parser;
+    unsigned x, y, page;
+    bool split;
+    std::map<int, std::pair<unsigned, unsigned> > glyphs;
+};
+
+
+template<typename T>
+void collectFonts(const BinPack2D::ContentAccumulator<T>& outputContent, unsigned gutter, std::vector<PlacedFont>& fonts)
+{
+    std::map<const GorillaFontParser*, std::size_t> indices;
+
+    for (typename BinPack2D::Content<T>::Vector::const_iterator itor = outputContent.Get().begin(); itor != outputContent.Get().end(); itor++)
+    {
+        const T& content = itor->content;
+        if (!content.isFont()) continue;
+
+        unsigned x = itor->coord.x + gutter;
+        unsigned y = itor->coord.y + gutter;
+
+        std::map<const GorillaFontParser*, std::size_t>::iterator index = indices.find(content.getFontParser());
+        if (index == indices.end())
+        {
+            PlacedFont font;
+            font.parser = content.getFontParser();
+            font.x = content.isGlyph() ? 0 : x;
+            font.y = content.isGlyph() ? 0 : y;
+            font.page = itor->coord.z;
+            font.split = content.isGlyph();
+            index = indices.insert(std::make_pair(content.getFontParser(), fonts.size())).first;
+            fonts.push_back(font);
+        }
+
+        if (content.isGlyph()) fonts[index->second].glyphs[content.getGlyphCode()] = std::make_pair(x, y);
+    }
+}
+
+
+// .gorilla text of a page: [Texture] with the whitepixel, the fonts, then [Sprites]
+template<typename T>
+void writeAtlasGorilla(std::ostream& file, const BinPack2D::ContentAccumulator<T>& pageContent, const std::string& imageFilename, unsigned gutter)
+{
+    unsigned whiteX, whiteY;
+    getWhitepixel(pageContent, gutter, whiteX, whiteY);
+
+    file << "[Texture]" << std::endl;
+    file << "file " << imageFilename << std::endl;
+    file << "whitepixel " << whiteX << " " << whiteY << '\n';
+    file << std::endl;
+
+    std::vector<PlacedFont> fonts;
+    collectFonts(pageContent, gutter, fonts);
+    for (std::vector<PlacedFont>::const_iterator it = fonts.begin(); it != fonts.end(); it++)
+    {
+        if (it->split) it->parser->appendGorilla(file, it->glyphs);
+        else it->parser->appendGorilla(file, it->x, it->y);
+    }
+    file << std::endl;
+
+    file << "[Sprites]" << std::endl;
+    for (typename BinPack2D::Content<T>::Vector::const_iterator itor = pageContent.Get().begin(); itor != pageContent.Get().end(); itor++)
+    {
+        const T& content = itor->content;
+
+        // The packed size can be padded, write the image size
+        if (!content.isFont() && !content.isWhitepixel())
+        {
+            appendGorillaSprite(file, content.getSpriteName(), itor->coord.x + gutter, itor->coord.y + gutter, content.getWidth(), content.getHeight());
+        }
+    }
+}
+
+
+// Adds to 'errors' the entries of a .gorilla (whitepixel, glyphs, sprites) reaching out of its
+// width x height page, one line each. Returns true when there are none.
+inline bool verifyGorilla(const std::string& gorilla, unsigned width, unsigned height, std::vector<std::string>& errors)
+{
+    std::size_t errorCount = errors.size();
+    std::istringstream in(gorilla);
+    std::string line;
+    bool sprites = false;
+    long offsetX = 0, offsetY = 0; // Of the current [Font.N], glyphs are relative to it
+
+    while (std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        std::vector<std::string> tokens;
+        std::string token;
+        while (fields >> token) tokens.push_back(token);
+
+        const std::string key = tokens.empty() ? "" : tokens[0];
+        if (key.empty()) continue;
+
+        if (key[0] == '[')
+        {
+            sprites = key == "[Sprites]";
+            offsetX = offsetY = 0;
+        }
+        else if (key == "offset" && tokens.size() == 3)
+        {
+            offsetX = atol(tokens[1].c_str());
+            offsetY = atol(tokens[2].c_str());
+        }
+        else if (key == "whitepixel" && tokens.size() == 3)
+        {
+            long x = atol(tokens[1].c_str()), y = atol(tokens[2].c_str());
+            if (x < 0 || y < 0 || x >= (long)width || y >= (long)height) errors.push_back(line);
+        }
+        else if ((sprites || key.compare(0, 6, "glyph_") == 0) && tokens.size() >= 5)
+        {
+            // The name may hold spaces, the rectangle ends the line
+            std::size_t n = tokens.size();
+            long x = atol(tokens[n - 4].c_str()) + (sprites ? 0 : offsetX);
+            long y = atol(tokens[n - 3].c_str()) + (sprites ? 0 : offsetY);
+            long w = atol(tokens[n - 2].c_str());
+            long h = atol(tokens[n - 1].c_str());
+
+            // Empty glyphs were not packed
+            if (w <= 0 || h <= 0) continue;
+
+            if (x < 0 || y < 0 || x + w > (long)width || y + h > (long)height) errors.push_back(line);
+        }
+    }
+
+    return errors.size() == errorCount;
+}
@@ -0,0 +1,299 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include "gorilla_image.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <math.h>
+#include <stdlib.h>
+
+
+// BC1 (DXT1) and BC3 (DXT5) block encoder.
+//
+// Endpoints are the extremes of the block along its principal color axis, inset a little to
+// reduce the error in the middle of the range. The per-pixel loops work on fixed size arrays
+// of 16 so the compiler can vectorize them.
+
+
+inline unsigned blockCompressedSize(TextureFormat format, unsigned width, unsigned height)
+{
+    unsigned blocks = ((width + 3) / 4) * ((height + 3) / 4);
+    return blocks * (format == TEXTURE_FORMAT_BC1 ? 8 : 16);
+}
+
+
+namespace BCn
+{
+
+inline WORD packRgb565(int r, int g, int b)
+{
+    return (WORD)(((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255));
+}
+
+
+inline void unpackRgb565(WORD c, int rgb[3])
+{
+    int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+
+// Read a 4x4 block, pixels past the image border repeat the last row/column.
+inline void fetchBlock(const RgbaImage& image, unsigned bx, unsigned by, BYTE block[16][4])
+{
+    for (unsigned y = 0; y < 4; y++)
+    {
+        unsigned sy = std::min(by * 4 + y, image.getHeight() - 1);
+        const BYTE* row = image.getRow(sy);
+
+        for (unsigned x = 0; x < 4; x++)
+        {
+            unsigned sx = std::min(bx * 4 + x, image.getWidth() - 1);
+            memcpy(block[y * 4 + x], row + sx * 4, 4);
+        }
+    }
+}
+
+
+// 'allowTransparent' lets BC1 switch to its 3 color + transparent mode for texels with alpha < 128.
+inline void encodeColorBlock(const BYTE block[16][4], bool allowTransparent, BYTE* out)
+{
+    bool used[16];
+    bool transparent = false;
+    int count = 0;
+
+    for (int i = 0; i < 16; i++)
+    {
+        // Color under fully transparent texels is meaningless, keep it out of the fit.
+        used[i] = block[i][3] >= (allowTransparent ? 128 : 1);
+        if (!used[i]) transparent = allowTransparent;
+        count += used[i];
+    }
+
+    if (!count)
+    {
+        // Nothing visible
+        WORD c = 0;
+        memcpy(out, &c, 2);
+        memcpy(out + 2, &c, 2);
+        DWORD indices = allowTransparent ? 0xffffffff : 0;
+        memcpy(out + 4, &indices, 4);
+        return;
+    }
+
+    // Mean and covariance
+    float mean[3] = {0, 0, 0};
+    for (int i = 0; i < 16; i++) if (used[i]) for (int c = 0; c < 3; c++) mean[c] += block[i][c];
+    for (int c = 0; c < 3; c++) mean[c] /= count;
+
+    float cov[6] = {0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < 16; i++)
+    {
+        if (!used[i]) continue;
+        float r = block[i][0] - mean[0], g = block[i][1] - mean[1], b = block[i][2] - mean[2];
+        cov[0] += r*r; cov[1] += r*g; cov[2] += r*b;
+        cov[3] += g*g; cov[4] += g*b; cov[5] += b*b;
+    }
+
+    // Principal axis by power iteration
+    float axis[3] = {1, 1, 1};
+    for (int it = 0; it < 4; it++)
+    {
+        float x = cov[0]*axis[0] + cov[1]*axis[1] + cov[2]*axis[2];
+        float y = cov[1]*axis[0] + cov[3]*axis[1] + cov[4]*axis[2];
+        float z = cov[2]*axis[0] + cov[4]*axis[1] + cov[5]*axis[2];
+        float m = std::max(fabsf(x), std::max(fabsf(y), fabsf(z)));
+        if (m == 0) break;
+        axis[0] = x / m; axis[1] = y / m; axis[2] = z / m;
+    }
+
+    float minProj = 1e9f, maxProj = -1e9f;
+    for (int i = 0; i < 16; i++)
+    {
+        if (!used[i]) continue;
+        float p = (block[i][0] - mean[0])*axis[0] + (block[i][1] - mean[1])*axis[1] + (block[i][2] - mean[2])*axis[2];
+        minProj = std::min(minProj, p);
+        maxProj = std::max(maxProj, p);
+    }
+
+    float len2 = axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2];
+    float inset = (maxProj - minProj) / 16.0f;
+    int ends[2][3];
+    for (int c = 0; c < 3; c++)
+    {
+        float lo = mean[c] + axis[c] * (minProj + inset) / (len2 ? len2 : 1);
+        float hi = mean[c] + axis[c] * (maxProj - inset) / (len2 ? len2 : 1);
+        ends[0][c] = std::min(255, std::max(0, (int)(hi + 0.5f)));
+        ends[1][c] = std::min(255, std::max(0, (int)(lo + 0.5f)));
+    }
+
+    WORD c0 = packRgb565(ends[0][0], ends[0][1], ends[0][2]);
+    WORD c1 = packRgb565(ends[1][0], ends[1][1], ends[1][2]);
+
+    // Four color mode needs c0 > c1, the transparent mode c0 <= c1.
+    if (transparent ? (c0 > c1) : (c0 < c1)) std::swap(c0, c1);
+
+    int palette[4][3];
+    unpackRgb565(c0, palette[0]);
+    unpackRgb565(c1, palette[1]);
+    int colors = 4;
+    if (transparent)
+    {
+        for (int c = 0; c < 3; c++) palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+        colors = 3;
+    }
+    else
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            palette[2][c] = (2*palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2*palette[1][c]) / 3;
+        }
+    }
+
+    DWORD indices = 0;
+    if (c0 != c1 || transparent)
+    {
+        for (int i = 15; i >= 0; i--)
+        {
+            unsigned best = 3;
+            if (used[i])
+            {
+                int bestError = 0x7fffffff;
+                for (int p = 0; p < colors; p++)
+                {
+                    int dr = block[i][0] - palette[p][0], dg = block[i][1] - palette[p][1], db = block[i][2] - palette[p][2];
+                    int error = dr*dr + dg*dg + db*db;
+                    if (error < bestError) { bestError = error; best = p; }
+                }
+            }
+            indices = (indices << 2) | best;
+        }
+    }
+
+    memcpy(out, &c0, 2);
+    memcpy(out + 2, &c1, 2);
+    memcpy(out + 4, &indices, 4);
+}
+
+
+inline void encodeAlphaBlock(const BYTE block[16][4], BYTE* out)
+{
+    int a0 = 0, a1 = 255;
+    for (int i = 0; i < 16; i++)
+    {
+        a0 = std::max(a0, (int)block[i][3]);
+        a1 = std::min(a1, (int)block[i][3]);
+    }
+
+    out[0] = (BYTE)a0;
+    out[1] = (BYTE)a1;
+
+    unsigned long long indices = 0;
+    if (a0 != a1)
+    {
+        // 8 alpha mode: a0, a1 and 6 interpolated values
+        int palette[8];
+        palette[0] = a0;
+        palette[1] = a1;
+        for (int p = 1; p < 7; p++) palette[p + 1] = ((7 - p) * a0 + p * a1) / 7;
+
+        for (int i = 15; i >= 0; i--)
+        {
+            int best = 0, bestError = 256;
+            for (int p = 0; p < 8; p++)
+            {
+                int error = abs(block[i][3] - palette[p]);
+                if (error < bestError) { bestError = error; best = p; }
+            }
+            indices = (indices << 3) | best;
+        }
+    }
+
+    for (int i = 0; i < 6; i++) out[2 + i] = (BYTE)(indices >> (8 * i));
+}
+
+} // namespace BCn
+
+
+// Encode a whole image, block rows are spread over 'threads' threads (0: one per core).
+inline void compressImage(const RgbaImage& image, TextureFormat format, std::vector<BYTE>& output, unsigned threads = 0)
+{
+    if (!isBlockCompressed(format)) throw std::runtime_error("Not a block compressed format");
+
+    unsigned blocksX = (image.getWidth() + 3) / 4;
+    unsigned blocksY = (image.getHeight() + 3) / 4;
+    unsigned blockSize = format == TEXTURE_FORMAT_BC1 ? 8 : 16;
+
+    output.assign(blocksX * blocksY * blockSize, 0);
+
+    if (!threads) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, blocksY);
+
+    std::atomic<unsigned> nextRow(0);
+
+    struct Worker
+    {
+        static void run(const RgbaImage* image, TextureFormat format, BYTE* output,
+                        unsigned blocksX, unsigned blocksY, unsigned blockSize, std::atomic<unsigned>* nextRow)
+        {
+            BYTE block[16][4];
+
+            for (unsigned by = (*nextRow)++; by < blocksY; by = (*nextRow)++)
+            {
+                BYTE* out = output + by * blocksX * blockSize;
+
+                for (unsigned bx = 0; bx < blocksX; bx++, out += blockSize)
+                {
+                    BCn::fetchBlock(*image, bx, by, block);
+
+                    if (format == TEXTURE_FORMAT_BC1)
+                    {
+                        BCn::encodeColorBlock(block, true, out);
+                    }
+                    else
+                    {
+                        BCn::encodeAlphaBlock(block, out);
+                        BCn::encodeColorBlock(block, false, out + 8);
+                    }
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; i++)
+    {
+        workers.push_back(std::thread(Worker::run, &image, format, &output[0], blocksX, blocksY, blockSize, &nextRow));
+    }
+    Worker::run(&image, format, &output[0], blocksX, blocksY, blockSize, &nextRow);
+
+    for (std::vector<std::thread>::iterator it = workers.begin(); it != workers.end(); it++) it->join();
+}
@@ -0,0 +1,412 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+// Benchmark of a whole gorilla_binpacker build on a synthetic corpus.
+//
+// Generates a corpus of sprites and fonts (with their .gorilla) from a seed, the same files for
+// the same --inputs and --seed, then runs the tool on it and writes a report: the stage times of
+// its --stats, the wall time, the peak memory and the output size. Every line is "key value"
+// sorted by key, reports of two versions diff line by line.
+//
+//   gorilla_bench --inputs 10000 -o before.txt -- --png-fast
+
+
+#include "gorilla_png.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+// Bumped when the generated corpus changes, an older corpus on disk is generated again
+const int g_corpus_version = 2;
+const unsigned g_font_every = 250; // One input in this many is a font
+
+
+// xorshift32, the corpus must not depend on the C library
+class Random
+{
+public:
+    Random(unsigned seed) : mState(seed ? seed : 0x9e3779b9)
+    {
+        // Close seeds start far apart
+        for (int i = 0; i < 4; i++) next();
+    }
+
+    unsigned next()
+    {
+        mState ^= mState << 13;
+        mState ^= mState >> 17;
+        mState ^= mState << 5;
+        return mState;
+    }
+
+    // [min, max]
+    unsigned range(unsigned min, unsigned max) { return min + next() % (max - min + 1); }
+
+protected:
+    unsigned mState;
+};
+
+
+void writePng(const std::string& filename, unsigned width, unsigned height, const std::vector<BYTE>& rgba)
+{
+    // Generating is not what is measured, the cheapest settings do
+    PngOptions options;
+    options.level = 1;
+    options.filter = PNG_FILTER_UP;
+    options.threads = 1;
+
+    PngWriter writer(filename, width, height, 4, options);
+    writer.writeRows(&rgba[0], height, width * 4);
+    writer.finish();
+}
+
+
+// A round blob with a gradient, transparent in the corners like most sprites
+void makeSprite(Random& random, const std::string& filename)
+{
+    // Mostly small icons and tiles, a few large images
+    unsigned pick = random.range(0, 99);
+    unsigned maxSize = pick < 70 ? 24 : pick < 98 ? 64 : 128;
+    unsigned minSize = pick < 70 ? 8 : pick < 98 ? 24 : 64;
+    unsigned width = random.range(minSize, maxSize);
+    unsigned height = random.range(minSize, maxSize);
+
+    BYTE color[3] = { (BYTE)random.next(), (BYTE)random.next(), (BYTE)random.next() };
+
+    std::vector<BYTE> rgba((std::size_t)width * height * 4);
+    for (unsigned y = 0; y < height; y++)
+    {
+        for (unsigned x = 0; x < width; x++)
+        {
+            // Distance to the center, 1 on the inscribed ellipse
+            float dx = (x + 0.5f) / width * 2.0f - 1.0f;
+            float dy = (y + 0.5f) / height * 2.0f - 1.0f;
+            float d = dx * dx + dy * dy;
+
+            BYTE* texel = &rgba[((std::size_t)y * width + x) * 4];
+            texel[0] = (BYTE)(color[0] * (1.0f - 0.5f * y / height));
+            texel[1] = (BYTE)(color[1] * (1.0f - 0.5f * x / width));
+            texel[2] = color[2];
+            texel[3] = d >= 1.0f ? 0 : d > 0.8f ? (BYTE)((1.0f - d) * 5.0f * 255.0f) : 255;
+        }
+    }
+
+    writePng(filename, width, height, rgba);
+}
+
+
+// White glyphs on a grid, with the .gorilla describing them. 'index' numbers the [Font.] section,
+// so every font of the atlas .gorilla has its own.
+void makeFont(Random& random, const std::string& filename, unsigned index)
+{
+    const unsigned columns = 16, rows = 6; // Codes 32 to 127
+    const unsigned cellWidth = random.range(6, 12), cellHeight = cellWidth + cellWidth / 2, spacing = 2;
+    unsigned width = columns * (cellWidth + spacing);
+    unsigned height = rows * (cellHeight + spacing);
+
+    std::vector<BYTE> rgba((std::size_t)width * height * 4, 0);
+    std::ostringstream gorilla;
+    gorilla << "[Font." << index << "]\n";
+    gorilla << "lineheight " << cellHeight << "\n";
+    gorilla << "spacelength " << cellWidth / 2 << "\n";
+    gorilla << "baseline " << cellHeight - 2 << "\n";
+    gorilla << "letterspacing 1\n";
+    gorilla << "monowidth " << cellWidth << "\n";
+    gorilla << "range 32 127\n";
+
+    for (unsigned code = 32; code < 128; code++)
+    {
+        unsigned x = (code - 32) % columns * (cellWidth + spacing);
+        unsigned y = (code - 32) / columns * (cellHeight + spacing);
+        unsigned w = random.range(cellWidth / 2, cellWidth);
+        gorilla << "glyph_" << code << " " << x << " " << y << " " << w << " " << cellHeight << "\n";
+
+        // A few strokes of coverage
+        for (unsigned gy = 0; gy < cellHeight; gy++)
+        {
+            unsigned mask = random.next();
+            for (unsigned gx = 0; gx < w; gx++)
+            {
+                BYTE* texel = &rgba[((std::size_t)(y + gy) * width + x + gx) * 4];
+                texel[0] = texel[1] = texel[2] = 255;
+                texel[3] = (mask >> (gx % 32)) & 1 ? 255 : 0;
+            }
+        }
+    }
+
+    writePng(filename, width, height, rgba);
+
+    std::ofstream file((filename.substr(0, filename.size() - 4) + ".gorilla").c_str());
+    file << gorilla.str();
+}
+
+
+// Relative filenames of the corpus inputs, generated unless 'directory' already holds this corpus
+std::vector<std::string> makeCorpus(const std::string& directory, unsigned inputs, unsigned seed)
+{
+    std::ostringstream description;
+    description << "version " << g_corpus_version << "\ninputs " << inputs << "\nseed " << seed << "\n";
+
+    std::vector<std::string> filenames;
+    for (unsigned i = 0; i < inputs; i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%s%06u.png", i % g_font_every == g_font_every - 1 ? "font" : "sprite", i);
+        filenames.push_back(name);
+    }
+
+    std::string descriptionFilename = directory + "/corpus.txt";
+    std::ifstream existing(descriptionFilename.c_str());
+    std::ostringstream existingText;
+    existingText << existing.rdbuf();
+    if (existing.is_open() && existingText.str() == description.str()) return filenames;
+
+    mkdir(directory.c_str(), 0755);
+    printf("Generating %u inputs in %s\n", inputs, directory.c_str());
+
+    // Each input has its own seed, the corpus of a smaller count is the start of a larger one
+    for (unsigned i = 0; i < inputs; i++)
+    {
+        Random random(seed * 2654435761u + i);
+        std::string filename = directory + "/" + filenames[i];
+        if (filenames[i].compare(0, 4, "font") == 0) makeFont(random, filename, i);
+        else makeSprite(random, filename);
+    }
+
+    // Written last, an interrupted generation is started over
+    std::ofstream file(descriptionFilename.c_str());
+    file << description.str();
+    return filenames;
+}
+
+
+long long getDirectorySize(const std::string& directory, const std::string& skipped)
+{
+    long long size = 0;
+
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) return 0;
+
+    while (struct dirent* entry = readdir(dir))
+    {
+        struct stat info;
+        std::string filename = directory + "/" + entry->d_name;
+        if (entry->d_name == skipped || stat(filename.c_str(), &info) || !S_ISREG(info.st_mode)) continue;
+        size += info.st_size;
+    }
+
+    closedir(dir);
+    return size;
+}
+
+
+// Runs the tool in the corpus directory, its output is discarded. Returns what --stats wrote and
+// the measures taken from outside.
+std::map<std::string, double> runBuild(const std::string& tool, const std::string& corpus, const std::vector<std::string>& inputs,
+                                       const std::vector<std::string>& toolArgs)
+{
+    std::string outputDirectory = corpus + "/out";
+    mkdir(outputDirectory.c_str(), 0755);
+
+    // Start from an empty directory so only this build is measured
+    DIR* dir = opendir(outputDirectory.c_str());
+    while (struct dirent* entry = dir ? readdir(dir) : NULL) unlink((outputDirectory + "/" + entry->d_name).c_str());
+    if (dir) closedir(dir);
+
+    std::vector<std::string> args;
+    args.push_back(tool);
+    args.push_back("-o");
+    args.push_back("out/atlas.png");
+    args.push_back("--stats");
+    args.push_back("out/stats.txt");
+    args.insert(args.end(), toolArgs.begin(), toolArgs.end());
+    args.insert(args.end(), inputs.begin(), inputs.end());
+
+    std::vector<char*> argv;
+    for (std::size_t i = 0; i < args.size(); i++) argv.push_back(const_cast<char*>(args[i].c_str()));
+    argv.push_back(NULL);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    pid_t pid = fork();
+    if (pid < 0) throw std::runtime_error("Error starting the tool");
+    if (pid == 0)
+    {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) dup2(null, STDOUT_FILENO);
+        if (chdir(corpus.c_str()) == 0) execv(tool.c_str(), &argv[0]);
+        _exit(127);
+    }
+
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid) throw std::runtime_error("Error waiting for the tool");
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) throw std::runtime_error("The tool failed on the corpus");
+
+    std::map<std::string, double> values;
+    std::ifstream stats((outputDirectory + "/stats.txt").c_str());
+    std::string key;
+    double value;
+    while (stats >> key >> value) values[key] = value;
+    if (values.empty()) throw std::runtime_error("No --stats written, is the tool older than --stats?");
+
+    values["time_wall_ms"] = wall * 1000.0;
+    values["process_peak_rss_kb"] = usage.ru_maxrss;
+    values["output_bytes"] = getDirectorySize(outputDirectory, "stats.txt");
+    return values;
+}
+
+
+int main(int argc, char** argv)
+{
+    unsigned inputs = 1000;
+    unsigned seed = 1;
+    unsigned runs = 1;
+    std::string corpus;
+    std::string tool = "./gorilla_binpacker";
+    std::string reportFilename;
+    std::vector<std::string> toolArgs;
+
+    // Parse arguments
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--inputs") && ++i < argc) inputs = atoi(argv[i]);
+        else if (!strcmp(argv[i], "--seed") && ++i < argc) seed = atoi(argv[i]);
+        else if (!strcmp(argv[i], "--runs") && ++i < argc) runs = atoi(argv[i]);
+        else if (!strcmp(argv[i], "--corpus") && ++i < argc) corpus = argv[i];
+        else if (!strcmp(argv[i], "--tool") && ++i < argc) tool = argv[i];
+        else if (!strcmp(argv[i], "-o") && ++i < argc) reportFilename = argv[i];
+        else if (!strcmp(argv[i], "--"))
+        {
+            toolArgs.assign(argv + i + 1, argv + argc);
+            break;
+        }
+        else
+        {
+            std::cout<<"Usage: [ --inputs 1000 ] [ --seed 1 ] [ --runs 1 ] [ --corpus directory ] [ --tool ./gorilla_binpacker ]"
+                       " [ -o report.txt ] [ -- tool options ... ]"<<std::endl;
+            return 1;
+        }
+    }
+
+    if (!inputs || !runs)
+    {
+        std::cout<<"--inputs and --runs take a count"<<std::endl;
+        return 1;
+    }
+
+    if (corpus.empty()) corpus = "bench_corpus_" + std::to_string(inputs) + "_" + std::to_string(seed);
+
+    // The tool runs in the corpus directory
+    char resolved[PATH_MAX];
+    if (!realpath(tool.c_str(), resolved))
+    {
+        std::cout<<"Tool not found: "<<tool<<std::endl;
+        return 1;
+    }
+    tool = resolved;
+
+    try
+    {
+        std::vector<std::string> filenames = makeCorpus(corpus, inputs, seed);
+
+        // The run with the lowest wall time, the others were slowed down by something else. All its
+        // values are kept together so the stages still add up.
+        std::map<std::string, double> best;
+        for (unsigned run = 0; run < runs; run++)
+        {
+            printf("Run %u/%u...\n", run + 1, runs);
+            fflush(stdout);
+
+            std::map<std::string, double> values = runBuild(tool, corpus, filenames, toolArgs);
+            if (best.empty() || values["time_wall_ms"] < best["time_wall_ms"]) best = values;
+        }
+
+        std::string args;
+        for (std::size_t i = 0; i < toolArgs.size(); i++) args += (i ? " " : "") + toolArgs[i];
+
+        long long corpusBytes = 0;
+        for (std::vector<std::string>::const_iterator it = filenames.begin(); it != filenames.end(); it++)
+        {
+            std::string filename = corpus + "/" + *it;
+            struct stat info;
+            if (!stat(filename.c_str(), &info)) corpusBytes += info.st_size;
+            if (!stat((filename.substr(0, filename.size() - 4) + ".gorilla").c_str(), &info)) corpusBytes += info.st_size;
+        }
+
+        std::map<std::string, std::string> lines;
+        lines["corpus_bytes"] = std::to_string(corpusBytes);
+        lines["corpus_inputs"] = std::to_string(inputs);
+        lines["corpus_seed"] = std::to_string(seed);
+        lines["runs"] = std::to_string(runs);
+        lines["tool_args"] = args;
+        for (std::map<std::string, double>::const_iterator it = best.begin(); it != best.end(); it++)
+        {
+            char value[32];
+            bool ms = it->first.size() > 3 && it->first.compare(it->first.size() - 3, 3, "_ms") == 0;
+            snprintf(value, sizeof(value), ms ? "%.1f" : "%.0f", it->second);
+            lines[it->first] = value;
+        }
+
+        std::ostringstream report;
+        for (std::map<std::string, std::string>::const_iterator it = lines.begin(); it != lines.end(); it++)
+        {
+            report << it->first << " " << it->second << '\n';
+        }
+
+        if (reportFilename.empty()) std::cout << report.str();
+        else
+        {
+            std::ofstream file(reportFilename.c_str());
+            file << report.str();
+            printf("Report written to %s\n", reportFilename.c_str());
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
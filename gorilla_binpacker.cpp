@@ -22,117 +22,1009 @@ SOFTWARE.
 
 
 #include "binpack2d.hpp"
+#include "binpack2d_balanced.hpp"
+#include "binpack2d_verify.hpp"
+#include "binpack2d_exact.hpp"
+#include "gorilla_bcn.hpp"
 #include "gorilla_binpacker.hpp"
+#include "gorilla_container.hpp"
+#include "gorilla_convert.hpp"
+#include "gorilla_dds.hpp"
+#include "gorilla_image.hpp"
+#include "gorilla_mipmap.hpp"
+#include "gorilla_patch.hpp"
+#include "gorilla_pipeline.hpp"
+#include "gorilla_png.hpp"
+#include "gorilla_watch.hpp"
 
 #include <FreeImage.h>
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
 #include <string>
 #include <deque>
+#include <limits>
 #include <stdexcept>
+#include <thread>
 #include <vector>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/resource.h>
 
 
 unsigned g_num_of_bin = 1;
 unsigned g_min_bin_dimension = 128;
+TextureFormat g_output_format = TEXTURE_FORMAT_DEFAULT;
+unsigned g_block_align = 1; // Packed sizes are rounded up to a multiple of this
+unsigned g_mip_levels = 1; // 0 for a full chain
+int g_gutter = -1; // Texels reserved around each image, -1 to derive it from the mip levels
+PngOptions g_png_options;
+bool g_stream = false; // Composite and encode by strips, sources are decoded when reached
+bool g_keep_pixels = false; // Watch mode reuses decoded images between builds
+bool g_split_glyphs = false; // Pack each glyph of the fonts on its own
+unsigned g_mask_cell = 0; // Cell size of mask packing in texels, 0 packs rectangles
+std::map<std::string, std::string> g_groups; // Input filename to its group, from --groups
+bool g_group_by_dir = false; // Inputs of a directory form a group
+double g_exact_seconds = 0; // Time for the exact search of the sizes the greedy packer misses, 0 to skip it
+std::chrono::steady_clock::time_point g_exact_deadline;
+const std::size_t g_exact_max_inputs = 50; // Larger sets are left to the greedy packer
+bool g_exact_proven = true; // No smaller size was left undecided by the exact search
+bool g_patch = false; // Write the changes from the previous atlas in a .patch file
+DecodePool* g_decoder = NULL; // Decodes the images not loaded up front while packing and compositing
+std::vector<std::pair<std::string, unsigned> > g_scales; // --scales labels and halvings from the packed size, largest first
+bool g_balance = false; // Deal the images evenly over the pages and fill them in parallel
+bool g_verify = false; // Check the layout and the written .gorilla files, failing the build on a problem
+BuildStats g_stats; // --stats
+TraceRecorder g_trace; // --trace
 
 
-int loadImages(const std::deque<std::string>& inputFilenames, BinPack2D::ContentAccumulator<MyContent>& inputContent)
+// The options of the build steps shared with the library
+AtlasOptions getAtlasOptions()
 {
+    AtlasOptions options;
+    options.gutter = g_gutter;
+    options.blockAlign = g_block_align;
+    options.maskCell = g_mask_cell;
+    options.pages = g_num_of_bin;
+    options.balance = g_balance;
+    return options;
+}
+
+
+// Cells of 'cell' texels holding a visible texel of the image with its gutter, grown by the gutter
+// so filtering never reaches a texel of another image.
+BinPack2D::Mask buildOccupancyMask(const RgbaImage& image, unsigned gutter, unsigned cell)
+{
+    unsigned width = image.getWidth() + 2 * gutter;
+    unsigned height = image.getHeight() + 2 * gutter;
+
+    // Visible texels of the padded image, dilated horizontally then vertically with running counts
+    std::vector<unsigned char> visible(width * height);
+    std::vector<BYTE> row(width * 4);
+    for (unsigned y = 0; y < height; y++)
+    {
+        copyPaddedSpan(image, gutter, y, 0, width, &row[0], false);
+        for (unsigned x = 0; x < width; x++) visible[y * width + x] = row[x * 4 + 3] != 0;
+    }
+
+    std::vector<unsigned char> dilated(width * height);
+    for (unsigned y = 0; y < height; y++)
+    {
+        const unsigned char* in = &visible[y * width];
+        unsigned count = 0;
+        for (unsigned x = 0; x < gutter && x < width; x++) count += in[x];
+        for (unsigned x = 0; x < width; x++)
+        {
+            if (x + gutter < width) count += in[x + gutter];
+            dilated[y * width + x] = count != 0;
+            if (x >= gutter) count -= in[x - gutter];
+        }
+    }
+
+    BinPack2D::Mask mask((width + cell - 1) / cell, (height + cell - 1) / cell);
+    for (unsigned x = 0; x < width; x++)
+    {
+        unsigned count = 0;
+        for (unsigned y = 0; y < gutter && y < height; y++) count += dilated[y * width + x];
+        for (unsigned y = 0; y < height; y++)
+        {
+            if (y + gutter < height) count += dilated[(y + gutter) * width + x];
+            if (count) mask.Set(x / cell, y / cell);
+            if (y >= gutter) count -= dilated[(y - gutter) * width + x];
+        }
+    }
+
+    return mask;
+}
+
+
+// The image of 'content' as pasted, from the decode pool when its pixels were not loaded
+BitmapHandle takeImage(const MyContent& content)
+{
+    if (content.hasPixels()) return content.getImage();
+    if (g_decoder && g_decoder->contains(content.getName()))
+    {
+        StageTimer timer("decode_wait", content.getName()); // The compositor waiting for the pool
+        return content.cutImage(g_decoder->take(content.getName()));
+    }
+    return content.cutImage(content.loadSource());
+}
+
+
+// Top to bottom then left to right, the order the compositors take the images in
+std::vector<BinPack2D::Content<MyContent>*> sortByRow(BinPack2D::ContentAccumulator<MyContent>& content)
+{
+    struct Above
+    {
+        bool operator()(const BinPack2D::Content<MyContent>* a, const BinPack2D::Content<MyContent>* b) const
+        {
+            return a->coord.y != b->coord.y ? a->coord.y < b->coord.y : a->coord.x < b->coord.x;
+        }
+    };
+
+    std::vector<BinPack2D::Content<MyContent>*> sorted;
+    for (binpack2d_iterator itor = content.Get().begin(); itor != content.Get().end(); itor++) sorted.push_back(&*itor);
+    std::sort(sorted.begin(), sorted.end(), Above());
+    return sorted;
+}
+
+
+void addContent(const MyContent& mycontent, BinPack2D::ContentAccumulator<MyContent>& inputContent)
+{
+    if (g_split_glyphs && mycontent.isFont() && !mycontent.isGlyph())
+    {
+        std::vector<MyContent> glyphs;
+        mycontent.splitGlyphs(glyphs);
+        for (std::vector<MyContent>::const_iterator it = glyphs.begin(); it != glyphs.end(); it++) addContent(*it, inputContent);
+        return;
+    }
+
+    if (g_mask_cell)
+    {
+        MyContent masked(mycontent);
+        std::shared_ptr<const BinPack2D::Mask> mask =
+            std::make_shared<BinPack2D::Mask>(buildOccupancyMask(mycontent.decodePixels(), g_gutter, g_mask_cell));
+        masked.setMask(mask);
+
+        inputContent += BinPack2D::Content<MyContent>(
+            masked, BinPack2D::Coord(), BinPack2D::Size(mask->w * g_mask_cell, mask->h * g_mask_cell), false);
+        return;
+    }
+
+    inputContent += BinPack2D::Content<MyContent>(
+        mycontent, BinPack2D::Coord(), getPackedSize(getAtlasOptions(), mycontent.getWidth(), mycontent.getHeight()), false);
+}
+
+
+// Manifest of --groups, a [group] line followed by the input filenames of the group:
+//   [hud]
+//   ui/hud/health.png
+void loadGroups(const std::string& filename)
+{
+    std::ifstream file(filename.c_str());
+    if (!file.is_open()) throw std::runtime_error("Error opening group manifest:"+filename);
+
+    std::string group;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+        if (line.empty() || line[0] == '#') continue;
+
+        if (line[0] == '[' && line[line.size() - 1] == ']') group = line.substr(1, line.size() - 2);
+        else if (group.empty()) throw std::runtime_error("Group manifest lists a file before any [group]:"+line);
+        else g_groups[line] = group;
+    }
+}
+
+
+std::string findGroup(const std::string& filename)
+{
+    std::map<std::string, std::string>::const_iterator it = g_groups.find(filename);
+    if (it != g_groups.end()) return it->second;
+
+    if (g_group_by_dir)
+    {
+        std::string::size_type slash = filename.find_last_of("/\\");
+        return slash == std::string::npos ? std::string(".") : filename.substr(0, slash);
+    }
+
+    return std::string();
+}
+
+
+// With a bundle, input filenames name entries of the bundle.
+int loadImages(const std::deque<std::string>& inputFilenames, BinPack2D::ContentAccumulator<MyContent>& inputContent,
+               const InputBundle* bundle = NULL)
+{
+    // Packing only needs the sizes, the pixels are decoded meanwhile by the decode pool. Masks are
+    // built from the pixels, they are kept to composite.
+    bool loadPixels = g_mask_cell && !g_stream;
+
     // Load files
     for (std::deque<std::string>::const_iterator it = inputFilenames.begin(); it != inputFilenames.end(); it++)
     {
-        MyContent mycontent(*it);
-        inputContent += BinPack2D::Content<MyContent>(
-            mycontent, BinPack2D::Coord(), 
-            BinPack2D::Size(mycontent.getWidth(), mycontent.getHeight()), false);
+        MyContent mycontent = bundle ? MyContent(*it, *bundle, loadPixels) : MyContent(*it, loadPixels);
+        mycontent.setGroup(findGroup(*it));
+        addContent(mycontent, inputContent);
     }
 
     // Create whitepixel
-    MyContent mycontent(g_whitepixel_name);
-    inputContent += BinPack2D::Content<MyContent>(
-        mycontent, BinPack2D::Coord(), 
-        BinPack2D::Size(mycontent.getWidth(), mycontent.getHeight()), false);
+    addContent(MyContent(g_whitepixel_name), inputContent);
 
     // Sort the input content by size... usually packs better.
     inputContent.Sort();
+
+    return 0;
 }
 
 
-void appendGorillaWhitePixel(std::ofstream& file, BinPack2D::ContentAccumulator<MyContent>& outputContent)
+void encodeImage(const RgbaImage& image, TextureFormat format, std::vector<BYTE>& output)
+{
+    if (isBlockCompressed(format)) compressImage(image, format, output);
+    else convertImage(image, format, output);
+}
+
+// Mip chain of the atlas in 'format', returns the format used when it was auto.
+TextureFormat encodeAtlas(FIBITMAP* outputBitmap, TextureFormat format, std::vector<std::vector<BYTE> >& levels)
 {
+    RgbaImage image(outputBitmap);
+
+    if (format == TEXTURE_FORMAT_AUTO)
+    {
+        format = detectTextureFormat(image);
+        printf("  FORMAT: %s\n", getTextureFormatName(format));
+    }
+
+    std::vector<RgbaImage> chain;
+    buildMipChain(image, g_mip_levels, chain);
+
+    levels.resize(chain.size());
+    for (std::size_t i = 0; i < chain.size(); i++) encodeImage(chain[i], format, levels[i]);
+
+    return format;
+}
+
+
+// .gatlas output, the sprite and font tables are stored with the pixels instead of a .gorilla file.
+void saveContainer(const std::vector<BitmapHandle>& pages, BinPack2D::ContentAccumulator<MyContent>& outputContent, const std::string& outputFilename)
+{
+    StageTimer timer("encode", outputFilename);
+    TextureFormat format = g_output_format;
+    if (format == TEXTURE_FORMAT_DEFAULT) format = TEXTURE_FORMAT_AUTO;
+
+    // Pages share a format, the one holding every page's texels (a8, then la88, then rgba8888)
+    if (format == TEXTURE_FORMAT_AUTO)
+    {
+        format = TEXTURE_FORMAT_A8;
+        for (std::vector<BitmapHandle>::const_iterator it = pages.begin(); it != pages.end(); it++)
+        {
+            format = std::max(format, detectTextureFormat(RgbaImage(it->get())));
+        }
+        printf("  FORMAT: %s\n", getTextureFormatName(format));
+    }
+
+    AtlasContainer container(format, FreeImage_GetWidth(pages[0].get()), FreeImage_GetHeight(pages[0].get()));
+
+    for (std::vector<BitmapHandle>::const_iterator it = pages.begin(); it != pages.end(); it++)
+    {
+        std::vector<std::vector<BYTE> > levels;
+        encodeAtlas(it->get(), format, levels);
+        container.addPage(levels);
+    }
+
     for (binpack2d_iterator itor = outputContent.Get().begin(); itor != outputContent.Get().end(); itor++)
     {
         const BinPack2D::Content<MyContent> &content = *itor;
-
-        // retreive your data.
         const MyContent& myContent = content.content;
 
-        if (myContent.getName() == g_whitepixel_name)
+        unsigned x = content.coord.x + g_gutter;
+        unsigned y = content.coord.y + g_gutter;
+
+        if (myContent.isWhitepixel())
         {
-            file << "whitepixel "; 
-            file << content.coord.x + content.size.w/2 << " "; 
-            file << content.coord.y + content.size.h/2 << '\n'; 
-            return;
+            container.setWhitepixel(x + myContent.getWidth()/2, y + myContent.getHeight()/2);
+        }
+        else if (!myContent.isFont())
+        {
+            container.addSprite(myContent.getSpriteName(), content.coord.z,
+                                x, y, myContent.getWidth(), myContent.getHeight());
         }
     }
 
-    throw std::runtime_error("Where is the whitepixel?");
+    std::vector<PlacedFont> fonts;
+    collectFonts(outputContent, g_gutter, fonts);
+
+    for (std::vector<PlacedFont>::const_iterator it = fonts.begin(); it != fonts.end(); it++)
+    {
+        GorillaFontParser* parser = it->parser;
+        ContainerFont& font = container.addFont(parser->getFontName(), it->page);
+
+        font.lineHeight = parser->getValue("lineheight");
+        font.spaceLength = parser->getValue("spacelength");
+        font.baseline = parser->getValue("baseline");
+        font.kerning = parser->getValue("kerning");
+        font.letterSpacing = parser->getValue("letterspacing");
+        font.monoWidth = parser->getValue("monowidth");
+        font.rangeFirst = parser->getValue("range", 0);
+        font.rangeLast = parser->getValue("range", 1);
+
+        std::vector<FontGlyph> glyphs;
+        parser->getGlyphs(glyphs);
+        for (std::vector<FontGlyph>::const_iterator glyph = glyphs.begin(); glyph != glyphs.end(); glyph++)
+        {
+            // Split glyphs have their own position, empty ones were not packed
+            unsigned x = it->x + glyph->x;
+            unsigned y = it->y + glyph->y;
+            if (it->split)
+            {
+                std::map<int, std::pair<unsigned, unsigned> >::const_iterator position = it->glyphs.find(glyph->code);
+                x = position == it->glyphs.end() ? 0 : position->second.first;
+                y = position == it->glyphs.end() ? 0 : position->second.second;
+            }
+
+            ContainerGlyph entry = { (uint32_t)glyph->code, x, y, (uint32_t)glyph->w, (uint32_t)glyph->h, glyph->verticalOffset };
+            container.addGlyph(entry);
+        }
+    }
+
+    container.write(outputFilename);
 }
 
 
-void appendGorillaFonts(std::ofstream& file, BinPack2D::ContentAccumulator<MyContent>& outputContent)
+// Returns the format written
+TextureFormat saveAtlas(FIBITMAP* outputBitmap, const std::string& outputFilename)
 {
-    for (binpack2d_iterator itor = outputContent.Get().begin(); itor != outputContent.Get().end(); itor++)
+    StageTimer timer("encode", outputFilename);
+    bool dds = getExtension(outputFilename) == "dds";
+    TextureFormat format = g_output_format;
+
+    if (format == TEXTURE_FORMAT_DEFAULT && dds) format = TEXTURE_FORMAT_AUTO;
+
+    if (dds)
     {
-        BinPack2D::Content<MyContent> &content = *itor;
+        std::vector<std::vector<BYTE> > levels;
+        format = encodeAtlas(outputBitmap, format, levels);
+        writeDDS(outputFilename, format, FreeImage_GetWidth(outputBitmap), FreeImage_GetHeight(outputBitmap), levels);
+        return format;
+    }
 
-        // retreive your data.
-        MyContent& myContent = content.content;
+    if (getExtension(outputFilename) == "png")
+    {
+        RgbaImage image(outputBitmap);
 
-        if (myContent.isFont()) myContent.appendGorilla(file, content);
+        if (format == TEXTURE_FORMAT_AUTO)
+        {
+            format = detectTextureFormat(image) == TEXTURE_FORMAT_A8 ? TEXTURE_FORMAT_A8 : TEXTURE_FORMAT_RGBA8888;
+            printf("  FORMAT: %s\n", getTextureFormatName(format));
+        }
+
+        PngWriter writer(outputFilename, image.getWidth(), image.getHeight(), format == TEXTURE_FORMAT_A8 ? 1 : 4, g_png_options);
+        if (format == TEXTURE_FORMAT_A8)
+        {
+            std::vector<BYTE> alpha;
+            convertImage(image, format, alpha);
+            writer.writeRows(&alpha[0], image.getHeight(), image.getWidth());
+        }
+        else if (format == TEXTURE_FORMAT_DEFAULT || format == TEXTURE_FORMAT_RGBA8888)
+        {
+            writer.writeRows(image.getRow(0), image.getHeight(), image.getWidth() * 4);
+        }
+        else
+        {
+            throw std::runtime_error(std::string("Format ")+getTextureFormatName(format)+" is written as .dds");
+        }
+        writer.finish();
+        return format == TEXTURE_FORMAT_DEFAULT ? TEXTURE_FORMAT_RGBA8888 : format;
+    }
+
+    if (format == TEXTURE_FORMAT_AUTO)
+    {
+        // Only alpha can be saved smaller through FreeImage
+        format = detectTextureFormat(RgbaImage(outputBitmap));
+        if (format != TEXTURE_FORMAT_A8) format = TEXTURE_FORMAT_DEFAULT;
+        printf("  FORMAT: %s\n", getTextureFormatName(format));
+    }
+
+    FREE_IMAGE_FORMAT fmt = FreeImage_GetFIFFromFilename(outputFilename.c_str());
+    if (fmt == FIF_UNKNOWN) throw std::runtime_error("Unknow output file format");
+
+    if (format == TEXTURE_FORMAT_A8)
+    {
+        // 8 bits grayscale image holding the alpha channel
+        BitmapHandle alphaBitmap = makeBitmapHandle(FreeImage_GetChannel(outputBitmap, FICC_ALPHA));
+        if (!alphaBitmap) throw std::runtime_error("Error extracting alpha channel");
+        FreeImage_Save(fmt, alphaBitmap.get(), outputFilename.c_str(), 0);
+    }
+    else if (format == TEXTURE_FORMAT_DEFAULT || format == TEXTURE_FORMAT_RGBA8888)
+    {
+        FreeImage_Save(fmt, outputBitmap, outputFilename.c_str(), 0);
     }
+    else
+    {
+        throw std::runtime_error(std::string("Format ")+getTextureFormatName(format)+" is written as .dds");
+    }
+
+    return format;
 }
 
 
-void appendGorillaSprites(std::ofstream& file, BinPack2D::ContentAccumulator<MyContent>& outputContent)
+// Source images are released once pasted unless g_keep_pixels is set.
+BitmapHandle compositeAtlas(BinPack2D::ContentAccumulator<MyContent>& outputContent, unsigned width, unsigned height)
 {
-    for (binpack2d_iterator itor = outputContent.Get().begin(); itor != outputContent.Get().end(); itor++)
+    StageTimer timer("composite");
+
+    // Create image
+    BitmapHandle outputBitmap = makeBitmapHandle(FreeImage_Allocate(width, height, 32));
+    if (!outputBitmap) throw std::runtime_error("Error creating output image");
+
+    // Fill background
+    BYTE transparent_byte = 0x00;
+    FreeImage_SetTransparencyTable(outputBitmap.get(), &transparent_byte, 1);
+
+    // Pack output image with data from our bin, in the order the images are decoded
+    AtlasOptions options = getAtlasOptions();
+    std::vector<BinPack2D::Content<MyContent>*> sorted = sortByRow(outputContent);
+    for (std::vector<BinPack2D::Content<MyContent>*>::iterator itor = sorted.begin(); itor != sorted.end(); itor++)
     {
-        BinPack2D::Content<MyContent> &content = *itor;
+        const BinPack2D::Content<MyContent> &content = **itor;
 
         // retreive your data.
-        MyContent& myContent = content.content;
+        MyContent& myContent = (*itor)->content;
+
+        BitmapHandle image = takeImage(myContent);
+        if (!image) throw std::runtime_error("Error loading input image:"+myContent.getName());
+
+        compositeRows(RgbaImage(image.get()), content.coord.x + g_gutter, content.coord.y + g_gutter, myContent.getMask(), options, 0, height,
+                      [&](unsigned row) { return FreeImage_GetScanLine(outputBitmap.get(), height - 1 - row); }, true);
+
+        // The whitepixel copies of the other pages share these pixels
+        if (!g_keep_pixels && !myContent.isWhitepixel()) myContent.releasePixels();
+    }
+
+    return outputBitmap;
+}
+
+
+// Composite a strip of rows at a time and hand each one to the png encoder. A source is decoded
+// when the strips reach its first row and released after its last, so memory holds a strip and
+// the sources crossing it instead of the whole atlas and every image. The encoder runs on its own
+// thread, compressing a strip while the next one is composited.
+void streamAtlas(BinPack2D::ContentAccumulator<MyContent>& outputContent, const std::string& outputFilename, unsigned width, unsigned height)
+{
+    // Picking a format from the texels would need all of them before the first row
+    TextureFormat format = g_output_format;
+    if (format == TEXTURE_FORMAT_DEFAULT || format == TEXTURE_FORMAT_AUTO) format = TEXTURE_FORMAT_RGBA8888;
+    if (format != TEXTURE_FORMAT_A8 && format != TEXTURE_FORMAT_RGBA8888)
+    {
+        throw std::runtime_error(std::string("Format ")+getTextureFormatName(format)+" can't be streamed");
+    }
+
+    struct Placement
+    {
+        const MyContent* content;
+        unsigned x, y; // Where the image goes, its gutter is around
+        RgbaImage pixels;
+    };
+
+    // Already top to bottom
+    std::vector<Placement> placements;
+    std::vector<BinPack2D::Content<MyContent>*> sorted = sortByRow(outputContent);
+    for (std::vector<BinPack2D::Content<MyContent>*>::const_iterator itor = sorted.begin(); itor != sorted.end(); itor++)
+    {
+        if (!(*itor)->content.getWidth() || !(*itor)->content.getHeight()) continue;
+
+        Placement placement;
+        placement.content = &(*itor)->content;
+        placement.x = (*itor)->coord.x + g_gutter;
+        placement.y = (*itor)->coord.y + g_gutter;
+        placements.push_back(placement);
+    }
+
+    unsigned channels = format == TEXTURE_FORMAT_A8 ? 1 : 4;
+    PngWriter writer(outputFilename, width, height, channels, g_png_options);
+
+    // Enough rows to give every encoder thread a band
+    unsigned stripRows = std::min(height, writer.getBandRows() * std::max(1u, std::thread::hardware_concurrency()));
+    unsigned stride = width * 4;
+    std::vector<BYTE> strip(channels == 4 ? 0 : (size_t)stripRows * stride); // A8 is composited in RGBA first
+
+    // Two buffers go back and forth between the compositor and the encoder
+    struct Rows
+    {
+        std::shared_ptr<std::vector<BYTE> > texels;
+        unsigned count;
+    };
+
+    BoundedQueue<Rows> composited(2);
+    BoundedQueue<Rows> encoded(2);
+    for (int i = 0; i < 2; i++)
+    {
+        Rows rows = { std::make_shared<std::vector<BYTE> >((size_t)stripRows * width * channels), 0 };
+        encoded.push(rows);
+    }
+
+    std::exception_ptr encodeError;
+    std::thread encoder([&]
+    {
+        try
+        {
+            g_trace.setThreadName("png encoder");
+            StageTimer timer("encode", outputFilename);
+            Rows rows;
+            while (composited.pop(rows))
+            {
+                writer.writeRows(&(*rows.texels)[0], rows.count, width * channels);
+                encoded.push(rows);
+            }
+            writer.finish();
+        }
+        catch (...)
+        {
+            encodeError = std::current_exception();
+            encoded.close();
+        }
+    });
+
+    try
+    {
+        StageTimer timer("composite", outputFilename);
+        AtlasOptions options = getAtlasOptions();
+        std::vector<Placement*> active;
+        std::size_t next = 0;
+
+        for (unsigned y0 = 0; y0 < height; y0 += stripRows)
+        {
+            unsigned y1 = std::min(height, y0 + stripRows);
+
+            // A free buffer, none when the encoder failed
+            Rows rows;
+            if (!encoded.pop(rows)) break;
+            rows.count = y1 - y0;
+
+            BYTE* target = channels == 4 ? &(*rows.texels)[0] : &strip[0];
+            memset(target, 0, (size_t)rows.count * stride);
+
+            // Decode the sources reaching this strip
+            while (next < placements.size() && placements[next].y - g_gutter < y1)
+            {
+                placements[next].pixels = RgbaImage(takeImage(*placements[next].content).get());
+                active.push_back(&placements[next++]);
+            }
+
+            for (std::vector<Placement*>::iterator it = active.begin(); it != active.end(); )
+            {
+                const Placement& placement = **it;
+                unsigned end = compositeRows(placement.pixels, placement.x, placement.y, placement.content->getMask(), options, y0, y1,
+                                             [&](unsigned row) { return &target[(size_t)(row - y0) * stride]; }, false);
+
+                // Done with it
+                if (end <= y1)
+                {
+                    (*it)->pixels = RgbaImage();
+                    it = active.erase(it);
+                }
+                else it++;
+            }
+
+            for (unsigned row = 0; channels == 1 && row < rows.count; row++)
+            {
+                Convert::rowToA8(&strip[(size_t)row * stride], &(*rows.texels)[(size_t)row * width], width);
+            }
+            composited.push(rows);
+        }
+    }
+    catch (...)
+    {
+        composited.close();
+        encoded.close();
+        encoder.join();
+        throw;
+    }
+
+    composited.close();
+    encoder.join();
+    if (encodeError) std::rethrow_exception(encodeError);
+}
+
+
+// Texels of the .png written by the previous build, returns their format or TEXTURE_FORMAT_DEFAULT
+// when there is none to compare with.
+TextureFormat loadPreviousTexels(const std::string& filename, unsigned width, unsigned height, std::vector<BYTE>& texels)
+{
+    texels.clear();
+
+    if (FreeImage_GetFileType(filename.c_str(), 0) != FIF_PNG) return TEXTURE_FORMAT_DEFAULT;
+    BitmapHandle bitmap = makeBitmapHandle(FreeImage_Load(FIF_PNG, filename.c_str(), 0));
+    if (!bitmap || FreeImage_GetWidth(bitmap.get()) != width || FreeImage_GetHeight(bitmap.get()) != height) return TEXTURE_FORMAT_DEFAULT;
+
+    // A8 pages are written as grayscale
+    switch (FreeImage_GetBPP(bitmap.get()))
+    {
+        case 8:
+            texels.resize((std::size_t)width * height);
+            for (unsigned y = 0; y < height; y++) memcpy(&texels[(std::size_t)y * width], FreeImage_GetScanLine(bitmap.get(), height - 1 - y), width);
+            return TEXTURE_FORMAT_A8;
+        case 32:
+            convertImage(RgbaImage(bitmap.get()), TEXTURE_FORMAT_RGBA8888, texels);
+            return TEXTURE_FORMAT_RGBA8888;
+    }
+
+    return TEXTURE_FORMAT_DEFAULT;
+}
+
+
+void writeGorilla(std::ostream& file, const BinPack2D::ContentAccumulator<MyContent>& outputContent, const std::string& outputFilename)
+{
+    StageTimer timer("gorilla", outputFilename);
+    writeAtlasGorilla(file, outputContent, outputFilename, g_gutter);
+}
+
+
+// --scales 2,1,0.5: the largest scale is the packed size, each other one is it halved a whole
+// number of times (up to 1/16).
+bool parseScales(const std::string& text)
+{
+    std::vector<std::pair<double, std::string> > scales;
+
+    std::istringstream list(text);
+    std::string label;
+    while (std::getline(list, label, ','))
+    {
+        char* end = NULL;
+        double scale = strtod(label.c_str(), &end);
+        if (label.empty() || *end || scale <= 0) return false;
+        scales.push_back(std::make_pair(scale, label));
+    }
+    if (scales.empty()) return false;
+
+    std::sort(scales.rbegin(), scales.rend());
+
+    g_scales.clear();
+    for (std::size_t i = 0; i < scales.size(); i++)
+    {
+        double ratio = scales[0].first / scales[i].first;
+        unsigned shift = 0;
+        while (shift < 4 && (1 << shift) * 1.001 < ratio) shift++;
+
+        if (fabs(ratio - (1 << shift)) > ratio * 0.001 || (i && shift == g_scales.back().second)) return false;
+        g_scales.push_back(std::make_pair(scales[i].second, shift));
+    }
+
+    return true;
+}
+
+
+// atlas@0.5x.png
+std::string getScaledFilename(const std::string& filename, const std::string& label)
+{
+    std::size_t dot = filename.find_last_of('.');
+    return filename.substr(0, dot) + "@" + label + "x" + (dot == std::string::npos ? "" : filename.substr(dot));
+}
+
+
+// The .gorilla of the atlas halved 'shift' times, written for 'filename'. Packing kept every
+// position on whole texels of the smallest scale; rectangles are rounded out, font metrics to the
+// nearest texel.
+std::string scaleGorilla(const std::string& gorilla, unsigned shift, const std::string& filename)
+{
+    std::istringstream in(gorilla);
+    std::ostringstream out;
+    std::string line;
+    bool sprites = false;
+    int half = (1 << shift) >> 1;
+
+    while (std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        std::vector<std::string> tokens;
+        std::string token;
+        while (fields >> token) tokens.push_back(token);
+
+        const std::string key = tokens.empty() ? "" : tokens[0];
+        if (key.empty() || key[0] == '[')
+        {
+            sprites = key == "[Sprites]";
+            out << line << '\n';
+        }
+        else if (key == "file")
+        {
+            out << "file " << filename << '\n';
+        }
+        else if ((key == "whitepixel" || key == "offset") && tokens.size() == 3)
+        {
+            out << key << " " << (atoi(tokens[1].c_str()) >> shift) << " " << (atoi(tokens[2].c_str()) >> shift) << '\n';
+        }
+        else if ((sprites || key.compare(0, 6, "glyph_") == 0) && tokens.size() >= 5)
+        {
+            // The name may hold spaces, the rectangle ends the line
+            std::size_t n = tokens.size();
+            int x = atoi(tokens[n - 4].c_str());
+            int y = atoi(tokens[n - 3].c_str());
+            int w = atoi(tokens[n - 2].c_str());
+            int h = atoi(tokens[n - 1].c_str());
+
+            std::size_t end = line.size();
+            for (int i = 0; i < 4; i++)
+            {
+                end = line.find_last_not_of(' ', end - 1);
+                end = line.find_last_of(' ', end);
+            }
 
-        if (!myContent.isFont() && myContent.getName() != g_whitepixel_name) myContent.appendGorilla(file, content);
+            out << line.substr(0, end + 1);
+            out << (x >> shift) << " " << (y >> shift) << " ";
+            out << ((x + w + (1 << shift) - 1) >> shift) - (x >> shift) << " ";
+            out << ((y + h + (1 << shift) - 1) >> shift) - (y >> shift) << " " << '\n';
+        }
+        else if (shift && key != "range" && tokens.size() > 1)
+        {
+            // lineheight, spacelength, baseline, kerning, letterspacing, monowidth, verticaloffset_N
+            out << key;
+            for (std::size_t i = 1; i < tokens.size(); i++)
+            {
+                int value = atoi(tokens[i].c_str());
+                out << " " << (value >= 0 ? (value + half) >> shift : -((-value + half) >> shift));
+            }
+            out << '\n';
+        }
+        else
+        {
+            out << line << '\n';
+        }
+    }
+
+    return out.str();
+}
+
+
+// Every scale of a page, halved from the composited image, each with its .gorilla
+void writeScaledPage(BinPack2D::ContentAccumulator<MyContent>& outputContent, const std::string& outputFilename,
+                     unsigned width, unsigned height)
+{
+    BitmapHandle outputBitmap = compositeAtlas(outputContent, width, height);
+
+    std::ostringstream gorilla;
+    writeGorilla(gorilla, outputContent, outputFilename);
+
+    RgbaImage image;
+    unsigned shift = 0;
+
+    for (std::vector<std::pair<std::string, unsigned> >::const_iterator it = g_scales.begin(); it != g_scales.end(); it++)
+    {
+        {
+            StageTimer timer("scale", it->first);
+            if (it->second && !shift) image = RgbaImage(outputBitmap.get());
+            for (; shift < it->second; shift++) image = downsampleImage(image);
+        }
+
+        std::string filename = getScaledFilename(outputFilename, it->first);
+        printf("  SCALE @%sx: %dx%d\n", it->first.c_str(), width >> shift, height >> shift);
+        saveAtlas(shift ? makeBitmap(image).get() : outputBitmap.get(), filename);
+
+        std::ofstream file((stripExtension(filename)+".gorilla").c_str());
+        file << scaleGorilla(gorilla.str(), shift, filename);
+    }
+}
+
+
+// One image and its .gorilla file
+void writePage(BinPack2D::ContentAccumulator<MyContent>& outputContent, const std::string& outputFilename,
+               unsigned page, unsigned width, unsigned height)
+{
+    std::string gorillaFilename = stripExtension(outputFilename)+".gorilla"; // Swap file extension
+
+    if (!g_scales.empty())
+    {
+        writeScaledPage(outputContent, outputFilename, width, height);
+        return;
+    }
+
+    if (g_patch)
+    {
+        BitmapHandle outputBitmap = compositeAtlas(outputContent, width, height);
+        RgbaImage image(outputBitmap.get());
+
+        // Read before the new page replaces it
+        std::vector<BYTE> previous;
+        TextureFormat previousFormat = loadPreviousTexels(outputFilename, width, height, previous);
+
+        TextureFormat format = saveAtlas(outputBitmap.get(), outputFilename);
+        if (format != previousFormat) previous.clear();
+
+        std::vector<BYTE> texels;
+        convertImage(image, format, texels);
+
+        std::ostringstream gorilla;
+        writeGorilla(gorilla, outputContent, outputFilename);
+
+        StageTimer patchTimer("patch", outputFilename);
+        AtlasPatch patch(previous, texels, width, height, getTexelSize(format));
+        patch.write(stripExtension(outputFilename)+".patch", page, format, texels, gorilla.str());
+        patchTimer.stop();
+        printf("  PATCH: %d rectangles, %d of %d texels\n", (int)patch.getRectCount(), (int)patch.getTexelCount(), width * height);
+
+        std::ofstream file(gorillaFilename.c_str());
+        file << gorilla.str();
+        return;
+    }
+
+    // The gorilla file only needs the placements, it is written while the image is
+    std::exception_ptr gorillaError;
+    std::thread gorillaWriter([&]
+    {
+        try
+        {
+            g_trace.setThreadName("gorilla writer");
+            std::ofstream file(gorillaFilename.c_str());
+            writeGorilla(file, outputContent, outputFilename);
+        }
+        catch (...)
+        {
+            gorillaError = std::current_exception();
+        }
+    });
+
+    try
+    {
+        // A png of a known format is encoded while it is composited, the whole image is needed otherwise
+        TextureFormat format = g_output_format;
+        bool stream = g_stream || (getExtension(outputFilename) == "png" &&
+            (format == TEXTURE_FORMAT_DEFAULT || format == TEXTURE_FORMAT_A8 || format == TEXTURE_FORMAT_RGBA8888));
+
+        if (stream)
+        {
+            streamAtlas(outputContent, outputFilename, width, height);
+        }
+        else
+        {
+            BitmapHandle outputBitmap = compositeAtlas(outputContent, width, height);
+
+            // Save image to file
+            saveAtlas(outputBitmap.get(), outputFilename);
+        }
+    }
+    catch (...)
+    {
+        gorillaWriter.join();
+        throw;
+    }
+
+    gorillaWriter.join();
+    if (gorillaError) std::rethrow_exception(gorillaError);
+}
+
+
+// --verify: every image inside its page and none overlapping another, in O(n log n)
+void verifyLayout(const BinPack2D::ContentAccumulator<MyContent>& outputContent, unsigned width, unsigned height)
+{
+    StageTimer timer("verify");
+    const BinPack2D::Content<MyContent>::Vector& contents = outputContent.Get();
+
+    std::vector<BinPack2D::LayoutError> errors;
+    BinPack2D::VerifyLayout<MyContent>(contents, width, height, g_num_of_bin, errors);
+
+    std::size_t problems = 0;
+    for (std::vector<BinPack2D::LayoutError>::const_iterator it = errors.begin(); it != errors.end(); it++)
+    {
+        // Masks nest images in the transparent cells of others, their rectangles overlap
+        if (g_mask_cell && it->other >= 0) continue;
+
+        const BinPack2D::Content<MyContent>& content = contents[it->index];
+        if (it->other < 0) printf("  VERIFY: %s at %d,%d,%d is out of its page\n", content.content.getName().c_str(),
+                                  content.coord.x, content.coord.y, content.coord.z);
+        else printf("  VERIFY: %s overlaps %s\n", content.content.getName().c_str(), contents[it->other].content.getName().c_str());
+        problems++;
+    }
+
+    if (problems) throw std::runtime_error("Layout verification failed");
+    printf("  VERIFIED: %d placements\n", (int)contents.size());
+}
+
+
+// --verify: every sprite and glyph of a written .gorilla inside its page
+void verifyGorillaFile(const std::string& filename, unsigned width, unsigned height)
+{
+    StageTimer timer("verify", filename);
+
+    std::ifstream file(filename.c_str());
+    if (!file.is_open()) throw std::runtime_error("Error reading:"+filename);
+    std::ostringstream gorilla;
+    gorilla << file.rdbuf();
+
+    std::vector<std::string> errors;
+    if (verifyGorilla(gorilla.str(), width, height, errors))
+    {
+        printf("  VERIFIED: %s\n", filename.c_str());
+        return;
+    }
+
+    for (std::vector<std::string>::const_iterator it = errors.begin(); it != errors.end(); it++)
+    {
+        printf("  VERIFY: %s: '%s' is out of its %dx%d page\n", filename.c_str(), it->c_str(), width, height);
     }
+    throw std::runtime_error("Gorilla verification failed:"+filename);
+}
+
+
+// Tell the decode pool the order the pages take their images in
+void scheduleDecodes(std::vector<BinPack2D::ContentAccumulator<MyContent> >& pageContent)
+{
+    if (!g_decoder) return;
+
+    std::vector<std::string> uses;
+    for (std::size_t page = 0; page < pageContent.size(); page++)
+    {
+        std::vector<BinPack2D::Content<MyContent>*> sorted = sortByRow(pageContent[page]);
+        for (std::vector<BinPack2D::Content<MyContent>*>::const_iterator it = sorted.begin(); it != sorted.end(); it++)
+        {
+            if (!(*it)->content.hasPixels()) uses.push_back((*it)->content.getName());
+        }
+    }
+
+    g_decoder->schedule(uses);
 }
 
 
 int packImages(const BinPack2D::ContentAccumulator<MyContent>& inputContent, const std::string& outputFilename, unsigned width, unsigned height)
 {
-    // Create some bins!
-    BinPack2D::CanvasArray<MyContent> canvasArray = 
-        BinPack2D::UniformCanvasArrayBuilder<MyContent>(width, height, g_num_of_bin).Build();
+    StageTimer packTimer("pack", std::to_string(width) + "x" + std::to_string(height)); // Every size tried adds to it
 
     // A place to store content that didnt fit into the canvas array.
     BinPack2D::ContentAccumulator<MyContent> remainder;
 
-    // try to pack content into the bins.
-    bool success = canvasArray.Place(inputContent, remainder);
-
     // A place to store packed content.
     BinPack2D::ContentAccumulator<MyContent> outputContent;
 
-    // Read all placed content.
-    canvasArray.CollectContent(outputContent);
+    AtlasPlaceReport report;
+    const char* exactResult = NULL;
+
+    {
+        TraceSpan span("place");
+        placeAtlas(inputContent, width, height, getAtlasOptions(), outputContent, remainder, report);
+    }
+
+    // Search every packing of the sizes the greedy placement misses
+    if (!remainder.Get().empty() && g_exact_seconds > 0 && !g_mask_cell)
+    {
+        double seconds = std::chrono::duration<double>(g_exact_deadline - std::chrono::steady_clock::now()).count();
+
+        TraceSpan exactSpan("exact");
+        BinPack2D::ExactCanvas<MyContent> exactCanvas(width, height);
+        BinPack2D::ExactCanvas<MyContent>::Result result = inputContent.Get().size() > g_exact_max_inputs || seconds <= 0 ?
+            BinPack2D::ExactCanvas<MyContent>::UNKNOWN : exactCanvas.Place(inputContent.Get(), seconds);
+
+        if (result == BinPack2D::ExactCanvas<MyContent>::FOUND)
+        {
+            remainder.Get().clear();
+            outputContent.Get().clear();
+            exactCanvas.CollectContent(outputContent);
+            exactResult = "found by search";
+        }
+        else if (result == BinPack2D::ExactCanvas<MyContent>::INFEASIBLE)
+        {
+            exactResult = "no packing exists";
+        }
+        else
+        {
+            g_exact_proven = false;
+            exactResult = inputContent.Get().size() > g_exact_max_inputs ? "too many images to search" : "time limit reached";
+        }
+    }
+
+    packTimer.stop();
 
     // Parse output.
     printf("\nResult for a bin of size %dx%d.\n", width, height);
-    printf("  PLACED: %d/%d\n", outputContent.Get().size(), inputContent.Get().size());
+    if (report.occupancy >= 0.0f) printf("  CELLS USED: %.1f%%\n", report.occupancy * 100.0f);
+    if (exactResult) printf("  EXACT: %s\n", exactResult);
+    printf("  PLACED: %d/%d\n", inputContent.Get().size() - remainder.Get().size(), inputContent.Get().size());
     for (binpack2d_iterator itor = outputContent.Get().begin(); itor != outputContent.Get().end(); itor++)
     {
         const BinPack2D::Content<MyContent> &content = *itor;
@@ -165,50 +1057,142 @@ int packImages(const BinPack2D::ContentAccumulator<MyContent>& inputContent, con
 
     if (!remainder.Get().empty()) return 1;
 
-    // Create image
-    FIBITMAP* outputBitmap = FreeImage_Allocate(width, height, 32);
-    if (!outputBitmap) throw std::runtime_error("Error creating output image");
+    if (g_verify) verifyLayout(outputContent, width, height);
 
-    // Fill background
-    BYTE transparent_byte = 0x00;
-    FreeImage_SetTransparencyTable(outputBitmap, &transparent_byte, 1);
+    for (std::vector<std::pair<std::string, int> >::const_iterator it = report.spreads.begin(); it != report.spreads.end(); it++)
+    {
+        printf("  GROUP %s on %d page%s\n", it->first.c_str(), it->second, it->second > 1 ? "s" : "");
+    }
 
-    // Pack output image with data from our bin
-    for (binpack2d_iterator itor = outputContent.Get().begin(); itor != outputContent.Get().end(); itor++)
+    unsigned pageCount = getPageCount(outputContent);
+
+    g_stats.setValue("atlas_width", width);
+    g_stats.setValue("atlas_height", height);
+    g_stats.setValue("atlas_pages", pageCount);
+
+    std::vector<BinPack2D::ContentAccumulator<MyContent> > pageContent = splitPages(outputContent, pageCount);
+
+    scheduleDecodes(pageContent);
+
+    if (getExtension(outputFilename) == "gatlas")
     {
-        const BinPack2D::Content<MyContent> &content = *itor;
+        // A single container holds every page
+        std::vector<BitmapHandle> pages;
+        for (unsigned page = 0; page < pageCount; page++) pages.push_back(compositeAtlas(pageContent[page], width, height));
+        saveContainer(pages, outputContent, outputFilename);
+        return 0;
+    }
 
-        // retreive your data.
-        const MyContent& myContent = content.content;
+    for (unsigned page = 0; page < pageCount; page++)
+    {
+        std::string filename = pageCount == 1 ? outputFilename :
+            stripExtension(outputFilename) + "_" + std::to_string(page) + "." + getExtension(outputFilename);
+        writePage(pageContent[page], filename, page, width, height);
 
-        if (!FreeImage_Paste(outputBitmap, const_cast<FIBITMAP*>(myContent.getBitmap()), 
-                             content.coord.x, content.coord.y,
-                             256)) throw std::runtime_error("Error pasting to output image");
+        if (g_verify && g_scales.empty()) verifyGorillaFile(stripExtension(filename)+".gorilla", width, height);
+        for (std::size_t i = 0; g_verify && i < g_scales.size(); i++)
+        {
+            verifyGorillaFile(stripExtension(getScaledFilename(filename, g_scales[i].first))+".gorilla",
+                              width >> g_scales[i].second, height >> g_scales[i].second);
+        }
+    }
+
+    return 0;
+}
+
+
+int packAtlas(const BinPack2D::ContentAccumulator<MyContent>& inputContent, const std::string& outputFilename)
+{
+    if (inputContent.Get().empty()) return 1;
+
+    // One time budget for every size the greedy packer misses
+    g_exact_deadline = std::chrono::steady_clock::now() +
+        std::chrono::microseconds((long long)(g_exact_seconds * 1e6));
+    g_exact_proven = true;
+
+    // Try all size combinations
+    searchAtlasSize(g_min_bin_dimension, std::numeric_limits<unsigned>::max(), [&](unsigned width, unsigned height)
+    {
+        return !packImages(inputContent, outputFilename, width, height);
+    });
+
+    // Sizes are tried by increasing area
+    if (g_exact_seconds > 0)
+    {
+        printf("\nExact search: %s\n", g_exact_proven ? "every smaller size has no packing, the size is optimal" :
+                                                       "a smaller size was left undecided, the size is not proven optimal");
+    }
+
+    return 0;
+}
+
+
+int watchImages(const std::deque<std::string>& inputFilenames, const std::string& outputFilename)
+{
+    // Watch before the first load so edits made meanwhile are not missed.
+    InputWatcher watcher(inputFilenames);
+
+    // Decoded images stay resident between builds, only changed files are reloaded.
+    g_keep_pixels = true;
+    std::map<std::string, MyContent> residentContent;
+    for (std::deque<std::string>::const_iterator it = inputFilenames.begin(); it != inputFilenames.end(); it++)
+    {
+        if (residentContent.find(*it) != residentContent.end()) continue;
+
+        MyContent mycontent(*it);
+        mycontent.setGroup(findGroup(*it));
+        residentContent.insert(std::make_pair(*it, mycontent));
+    }
+    MyContent whitepixel(g_whitepixel_name);
+
+    while (true)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        // A failed build waits for the next change, the edit fixing it
+        try
+        {
+            BinPack2D::ContentAccumulator<MyContent> inputContent;
+            for (std::deque<std::string>::const_iterator it = inputFilenames.begin(); it != inputFilenames.end(); it++)
+            {
+                addContent(residentContent.find(*it)->second, inputContent);
+            }
+            addContent(whitepixel, inputContent);
+            inputContent.Sort();
+
+            packAtlas(inputContent, outputFilename);
+
+            std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+            printf("\nAtlas written in %dms, watching for changes...\n",
+                (int)std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+            printf("\nBuild failed, watching for changes...\n");
+        }
+        fflush(stdout);
+
+        std::set<std::string> changedFilenames;
+        watcher.waitForChanges(changedFilenames);
+
+        for (std::set<std::string>::const_iterator it = changedFilenames.begin(); it != changedFilenames.end(); it++)
+        {
+            try
+            {
+                MyContent mycontent(*it);
+                mycontent.setGroup(findGroup(*it));
+                residentContent.erase(*it);
+                residentContent.insert(std::make_pair(*it, mycontent));
+            }
+            catch (const std::runtime_error& e)
+            {
+                // Keep the previous version until the file is readable again
+                std::cerr << e.what() << std::endl;
+            }
+        }
     }
 
-    // Save image to file
-    FREE_IMAGE_FORMAT fmt = FreeImage_GetFIFFromFilename(outputFilename.c_str());
-    if (fmt == FIF_UNKNOWN) throw std::runtime_error("Unknow output file format");
-    FreeImage_Save(fmt, outputBitmap, outputFilename.c_str(), 0);
-
-    // Create the gorilla file
-    std::string filename = stripExtension(outputFilename)+".gorilla"; // Swap file extension
-    std::ofstream file(filename.c_str());
-
-    // Append header (file/whitepixel)
-    file << "[Texture]" << std::endl;
-    file << "file " << outputFilename << std::endl;
-    appendGorillaWhitePixel(file, outputContent);
-    file << std::endl;
-    
-    // Append fonts
-    appendGorillaFonts(file, outputContent);
-    file << std::endl;
-
-    // Append sprites
-    file << "[Sprites]" << std::endl;
-    appendGorillaSprites(file, outputContent);
-    
     return 0;
 }
 
@@ -217,12 +1201,53 @@ int main(int argc, char** argv)
 {
     std::deque<std::string> inputFilenames;
     std::string outputFilename;
+    std::string bundleFilename;
+    bool watch = false;
+    int maskCell = 0;
+    int pageCount = 1;
+    std::string scales;
+    std::string statsFilename;
+    std::string traceFilename;
 
     // Parse arguments
     {
         for (size_t i = 1; i < argc; i++)
         {
             if (!strcmp(argv[i], "-o") && ++i < argc) outputFilename = std::string(argv[i]);
+            else if (!strcmp(argv[i], "--watch")) watch = true;
+            else if (!strcmp(argv[i], "--bundle") && ++i < argc) bundleFilename = std::string(argv[i]);
+            else if (!strcmp(argv[i], "--format") && ++i < argc) g_output_format = parseTextureFormat(argv[i]);
+            else if (!strcmp(argv[i], "--mips") && ++i < argc) g_mip_levels = atoi(argv[i]);
+            else if (!strcmp(argv[i], "--gutter") && ++i < argc) g_gutter = atoi(argv[i]);
+            else if (!strcmp(argv[i], "--png-level") && ++i < argc) g_png_options.level = atoi(argv[i]);
+            else if (!strcmp(argv[i], "--png-filter") && ++i < argc) g_png_options.filter = parsePngFilter(argv[i]);
+            else if (!strcmp(argv[i], "--stream")) g_stream = true;
+            else if (!strcmp(argv[i], "--split-glyphs")) g_split_glyphs = true;
+            else if (!strcmp(argv[i], "--mask") && ++i < argc) maskCell = atoi(argv[i]);
+            else if (!strcmp(argv[i], "--pages") && ++i < argc) pageCount = atoi(argv[i]);
+            else if (!strcmp(argv[i], "--groups") && ++i < argc) loadGroups(argv[i]);
+            else if (!strcmp(argv[i], "--group-by-dir")) g_group_by_dir = true;
+            else if (!strcmp(argv[i], "--balance")) g_balance = true;
+            else if (!strcmp(argv[i], "--verify")) g_verify = true;
+            else if (!strcmp(argv[i], "--patch")) g_patch = true;
+            else if (!strcmp(argv[i], "--scales") && ++i < argc) scales = argv[i];
+            else if (!strcmp(argv[i], "--stats") && ++i < argc) statsFilename = argv[i];
+            else if (!strcmp(argv[i], "--trace") && ++i < argc) traceFilename = argv[i];
+            else if (!strcmp(argv[i], "--exact"))
+            {
+                // The time limit is optional
+                char* end = NULL;
+                double seconds = i + 1 < argc ? strtod(argv[i + 1], &end) : 0;
+                if (end && end != argv[i + 1] && !*end) i++;
+                else seconds = 10;
+                g_exact_seconds = seconds;
+            }
+            else if (!strcmp(argv[i], "--png-fast"))
+            {
+                // Iteration builds: cheapest deflate, one cheap filter
+                g_png_options.level = 1;
+                g_png_options.filter = PNG_FILTER_UP;
+            }
             // TODO image size...
             //else if (!strcmp(argv[i], "-port") && ++i < argc) mSettings.server_port = std::stoi(std::string(argv[i]));
             else
@@ -231,33 +1256,180 @@ int main(int argc, char** argv)
             }
         }
 
-        if (inputFilenames.empty() || outputFilename.empty())
+        if ((inputFilenames.empty() && bundleFilename.empty()) || outputFilename.empty())
+        {
+            std::cout<<"Usage: [ -o output filename ] [ --watch ] [ --bundle archive.tar|zip ] [ --format default|auto|a8|la88|rgb565|rgba4444|rgba8888|bc1|bc3 ]"
+                     " [ --mips N ] [ --gutter N ] [ --png-level 0-9 ] [ --png-filter none|sub|up|average|paeth|adaptive ]"
+                     " [ --png-fast ] [ --stream ] [ --split-glyphs ] [ --mask N ] [ --pages N ] [ --balance ] [ --groups manifest ] [ --group-by-dir ]"
+                     " [ --exact [seconds] ] [ --patch ] [ --scales 2,1,0.5 ] [ --stats stats.txt ] [ --trace trace.json ] [ --verify ] [ input filenames ... ]";
+            return 1;
+        }
+
+        if (g_stream && (watch || getExtension(outputFilename) != "png" || g_mip_levels != 1))
+        {
+            std::cout<<"--stream writes a single level .png and doesn't watch"<<std::endl;
+            return 1;
+        }
+
+        if (g_patch && (g_stream || getExtension(outputFilename) != "png"))
+        {
+            std::cout<<"--patch compares .png pages, without --stream"<<std::endl;
+            return 1;
+        }
+
+        if (watch && !bundleFilename.empty())
+        {
+            std::cout<<"--watch reads loose files, not a bundle"<<std::endl;
+            return 1;
+        }
+
+        if (watch && (!statsFilename.empty() || !traceFilename.empty()))
         {
-            std::cout<<"Usage: [ -o output filename ] [ input filenames ... ]";
+            std::cout<<"--stats and --trace time a single build, not --watch"<<std::endl;
+            return 1;
+        }
+
+        bool rawOutput = getExtension(outputFilename) == "dds" || getExtension(outputFilename) == "gatlas";
+
+        if (isBlockCompressed(g_output_format))
+        {
+            if (!rawOutput)
+            {
+                std::cout<<"Block compressed formats are written as .dds or .gatlas"<<std::endl;
+                return 1;
+            }
+
+            // Never let a 4x4 block straddle two sprites
+            g_block_align = 4;
+        }
+
+        if (g_mip_levels != 1)
+        {
+            if (!rawOutput)
+            {
+                std::cout<<"Mip levels are written as .dds or .gatlas"<<std::endl;
+                return 1;
+            }
+
+            // Keep images on texel boundaries of the first levels, with a gutter wide enough
+            // for them. Past the 4th level a texel covers 16 and bleeding is accepted.
+            unsigned safeLevels = (g_mip_levels == 0 || g_mip_levels > 4) ? 4 : g_mip_levels;
+            unsigned mipAlign = 1 << (safeLevels - 1);
+            if (g_gutter < 0) g_gutter = mipAlign;
+            if (mipAlign > g_block_align) g_block_align = mipAlign;
+        }
+
+        if (g_gutter < 0) g_gutter = 0;
+
+        if (!scales.empty())
+        {
+            if (!parseScales(scales) || g_stream || g_patch || getExtension(outputFilename) == "gatlas")
+            {
+                std::cout<<"--scales takes scales halving the largest one (2,1,0.5), without --stream, --patch or .gatlas"<<std::endl;
+                return 1;
+            }
+
+            // Every scale keeps the alignment, gutter and whitepixel asked for, so packing at the
+            // largest one leaves every position on whole texels of the smallest.
+            unsigned shift = g_scales.back().second;
+            g_block_align <<= shift;
+            g_gutter <<= shift;
+            g_whitepixel_size <<= shift;
+        }
+
+        if (maskCell < 0)
+        {
+            std::cout<<"--mask takes a cell size in texels"<<std::endl;
+            return 1;
+        }
+
+        // Whole cells change owner, a block or mip texel must not span two of them
+        if (maskCell) g_mask_cell = (maskCell + g_block_align - 1) / g_block_align * g_block_align;
+
+        if (pageCount < 1 || (pageCount > 1 && maskCell))
+        {
+            std::cout<<"--pages takes a page count, a single page with --mask"<<std::endl;
+            return 1;
+        }
+        g_num_of_bin = pageCount;
+
+        if (g_balance && pageCount < 2)
+        {
+            std::cout<<"--balance spreads the images over --pages N"<<std::endl;
+            return 1;
+        }
+
+        if (g_exact_seconds > 0 && (pageCount > 1 || maskCell))
+        {
+            std::cout<<"--exact packs rectangles on a single page"<<std::endl;
             return 1;
         }
     }
 
     FreeImage_Initialise();
 
-    BinPack2D::ContentAccumulator<MyContent> inputContent;
-    loadImages(inputFilenames, inputContent);
-    printf("\n");
-
-    if (!inputContent.Get().empty())
+    if (watch)
     {
-        unsigned curr_size = g_min_bin_dimension;
-        unsigned next_size = curr_size * 2;
+        watchImages(inputFilenames, outputFilename);
+    }
+    else
+    {
+        if (!traceFilename.empty()) g_trace.start();
+
+        StageTimer totalTimer("total");
+        BinPack2D::ContentAccumulator<MyContent> inputContent;
+
+        // Stays mapped until the atlas is written, --stream decodes from it while compositing
+        std::unique_ptr<InputBundle> bundle(bundleFilename.empty() ? NULL : new InputBundle(bundleFilename));
+
+        // Every image of the bundle unless some are named, font .gorilla files are found next to their image
+        if (bundle && inputFilenames.empty())
+        {
+            const std::vector<std::string>& names = bundle->getNames();
+            for (std::vector<std::string>::const_iterator it = names.begin(); it != names.end(); it++)
+            {
+                if (getExtension(*it) != "gorilla") inputFilenames.push_back(*it);
+            }
+        }
+
+        {
+            StageTimer timer("load");
+            loadImages(inputFilenames, inputContent, bundle.get());
+        }
+        printf("\n");
+        g_stats.setValue("inputs", inputFilenames.size());
 
-        while (true)
         {
-            // Try all size combinations
-            if (!packImages(inputContent, outputFilename, curr_size, curr_size)) break;
-            if (!packImages(inputContent, outputFilename, next_size, curr_size)) break;
-            if (!packImages(inputContent, outputFilename, curr_size, next_size)) break;
+            // Decoded in input order while packing, then in compositing order once scheduled. Only a
+            // window of them waits for the compositor, the rest are decoded as it gets near them.
+            std::vector<MyContent> sources;
+            for (binpack2d_iterator itor = inputContent.Get().begin(); itor != inputContent.Get().end(); itor++)
+            {
+                if (!itor->content.hasPixels()) sources.push_back(itor->content);
+            }
+
+            unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+            DecodePool decoder(sources, threads, 2 * threads);
+            g_decoder = &decoder;
+
+            packAtlas(inputContent, outputFilename);
+
+            g_decoder = NULL;
+        }
+
+        bundle.reset();
+
+        totalTimer.stop();
+        if (!traceFilename.empty()) g_trace.write(traceFilename);
+
+        if (!statsFilename.empty())
+        {
+
+            struct rusage usage;
+            if (!getrusage(RUSAGE_SELF, &usage)) g_stats.setValue("peak_rss_kb", usage.ru_maxrss);
 
-            curr_size = next_size;
-            next_size *= 2;
+            std::ofstream file(statsFilename.c_str());
+            g_stats.write(file);
         }
     }
 
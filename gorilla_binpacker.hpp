@@ -24,257 +24,223 @@ SOFTWARE.
 #pragma once
 
 #include "binpack2d.hpp"
+#include "binpack2d_mask.hpp"
+#include "gorilla_atlas.hpp"
+#include "gorilla_bundle.hpp"
+#include "gorilla_font.hpp"
+#include "gorilla_image.hpp"
+#include "gorilla_trace.hpp"
 
 #include <FreeImage.h>
 
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <stdexcept>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
 
 
 std::string g_whitepixel_name = "__whitepixel__";
 unsigned g_whitepixel_size = 3;
 
 
-class GlyphData
+// Your data - whatever you want to associate with 'rectangle'
+//
+// Copies share the decoded image and the font parser, the last copy frees them.
+class MyContent
 {
 public:
-    int x() { return values[0]; }
-    int y() { return values[1]; }
-    int w() { return values[2]; }
-    int h() { return values[3]; }
-
-    void extractFromLine(const std::string& line)
+    // Without 'loadPixels' only the dimensions are read, decodePixels() loads the image when needed.
+    MyContent(const std::string& name, bool loadPixels = true)
+        : mName(name), mPixels(std::make_shared<BitmapHandle>()), mBundle(NULL),
+          mGlyph(false), mGlyphCode(0), mSourceX(0), mSourceY(0)
     {
-        std::size_t startPos = 0;
-        std::size_t endPos = 0;
-
-        for (unsigned i = 0; i < 4; i++)
+        TraceSpan span("load", mName);
+        initBitmap(loadBitmap(loadPixels ? 0 : FIF_LOAD_NOPIXELS), loadPixels);
+        if (name != g_whitepixel_name)
         {
-            startPos = line.find(" ", endPos);
-            endPos = line.find(" ", startPos+1);
-            if (startPos == std::string::npos) throw std::runtime_error("Error extracting glyph data");
-            std::string num = line.substr(startPos, endPos);
-            values[i] = atoi(num.c_str());
+            TraceSpan fontSpan("font", mName);
+            initFontParser(new GorillaFontParser(mName));
         }
-    }
 
-protected:
-    int values[4];
-};
-
-
-std::string stripPath(const std::string& filename)
-{
-    std::size_t startPos = 0;
-
-    // Nix directory separator
-    std::size_t symbolPos = filename.find_last_of('/');
-    if (symbolPos != std::string::npos) startPos = symbolPos + 1;
-
-    // Windows directory separator
-    symbolPos = filename.find_last_of('\\');
-    if (symbolPos != std::string::npos && symbolPos > startPos) startPos = symbolPos + 1;
-
-    return filename.substr(startPos, std::string::npos);
-}
+        std::cout<<"New image loaded: "<<getName()<<" - width:"<<getWidth()<<" - height:"<<getHeight()<<std::endl;
+    }
 
+    // Decode 'name' from the mapped bundle, no file is opened
+    // The bundle must stay mapped until the pixels are decoded.
+    MyContent(const std::string& name, const InputBundle& bundle, bool loadPixels = true)
+        : mName(name), mPixels(std::make_shared<BitmapHandle>()), mBundle(&bundle),
+          mGlyph(false), mGlyphCode(0), mSourceX(0), mSourceY(0)
+    {
+        TraceSpan span("load", mName);
+        initBitmap(loadBitmap(loadPixels ? 0 : FIF_LOAD_NOPIXELS), loadPixels);
 
-std::string stripExtension(const std::string& filename)
-{
-    return filename.substr(0, filename.find_last_of('.'));
-}
+        const BundleEntry* font = bundle.find(stripExtension(mName) + ".gorilla");
+        if (font)
+        {
+            TraceSpan fontSpan("font", mName);
+            initFontParser(new GorillaFontParser((const char*)font->data, font->size));
+        }
 
+        std::cout<<"New image loaded: "<<getName()<<" - width:"<<getWidth()<<" - height:"<<getHeight()<<std::endl;
+    }
 
-class GorillaFontParser
-{
-public:
-    GorillaFontParser(const std::string& imageFilename)
+    // One content per glyph of this font, cut from the shared sheet. Empty glyphs are left out.
+    void splitGlyphs(std::vector<MyContent>& glyphs) const
     {
-        std::string fn = stripExtension(imageFilename);
-        fn += ".gorilla";
-        mFile.open(fn.c_str());
-        if (!isLoaded()) return;
+        std::vector<FontGlyph> fontGlyphs;
+        mFontParser->getGlyphs(fontGlyphs);
 
-        parseDimension();
+        for (std::vector<FontGlyph>::const_iterator it = fontGlyphs.begin(); it != fontGlyphs.end(); it++)
+        {
+            if (it->w <= 0 || it->h <= 0) continue;
+            if (it->x < 0 || it->y < 0) throw std::runtime_error("Glyph outside of font image:"+mName);
+
+            MyContent glyph(*this);
+            glyph.mPixels = std::make_shared<BitmapHandle>(*mPixels); // The sheet is freed with its last glyph
+            glyph.mGlyph = true;
+            glyph.mGlyphCode = it->code;
+            glyph.mSourceX = it->x;
+            glyph.mSourceY = it->y;
+            glyph.mWidth = it->w;
+            glyph.mHeight = it->h;
+            glyphs.push_back(glyph);
+        }
     }
 
-    bool isLoaded() const { return mFile.is_open(); }
+    bool isWhitepixel() const { return mName == g_whitepixel_name; }
+    bool isFont() const { return mFontParser.get() != NULL; }
+    bool isGlyph() const { return mGlyph; }
+    int getGlyphCode() const { return mGlyphCode; }
+    GorillaFontParser* getFontParser() const { return mFontParser.get(); }
+    const std::string& getName() const { return mName; }
+    std::string getSpriteName() const { return stripExtension(stripPath(mName)); }
     unsigned getWidth() const { return mWidth; }
     unsigned getHeight() const { return mHeight; }
 
-    void appendGorilla(std::ofstream& outFile, unsigned xOffset, unsigned yOffset)
+    // The image as it goes in the atlas, NULL when the pixels were not kept or were released
+    BitmapHandle getImage() const
     {
-        resetSeek();
+        if (!mGlyph || !*mPixels) return *mPixels;
+        return makeBitmapHandle(FreeImage_Copy(mPixels->get(), mSourceX, mSourceY, mSourceX + mWidth, mSourceY + mHeight));
+    }
 
-        appendInfo(outFile, "[Font.");
-        appendInfo(outFile, "lineheight ");
-        appendInfo(outFile, "spacelength ");
-        appendInfo(outFile, "baseline ");
-        appendInfo(outFile, "kerning ");
-        appendInfo(outFile, "letterspacing ");
-        appendInfo(outFile, "monowidth ");
-        appendInfo(outFile, "range ");
-        outFile << "offset " << xOffset << " " << yOffset << std::endl;
+    // Cells covered by the image and its gutter, for mask packing
+    const BinPack2D::Mask* getMask() const { return mMask.get(); }
+    void setMask(const std::shared_ptr<const BinPack2D::Mask>& mask) { mMask = mask; }
 
-        resetSeek();
+    // Images used together are kept on the same page, empty when the image has no group
+    const std::string& getGroup() const { return mGroup; }
+    void setGroup(const std::string& group) { mGroup = group; }
 
-        std::string line;
-        GlyphData glyphs;
+    // Free the decoded image for every copy, decodePixels() can still load it again.
+    void releasePixels() { mPixels->reset(); }
+    bool hasPixels() const { return (bool)*mPixels; }
 
-        while (!mFile.eof())
-        {
-            std::getline(mFile, line);
-            if (line.find("glyph_") != std::string::npos)
-            {
-                outFile << line.substr(0, line.find(" ")) << " ";
-                glyphs.extractFromLine(line);
-                outFile << glyphs.x() << " ";
-                outFile << glyphs.y() << " ";
-                outFile << glyphs.w() << " ";
-                outFile << glyphs.h() << " ";
-                outFile << std::endl;
-            }
-            else if (line.find("verticaloffset_") != std::string::npos)
-            {
-                outFile << line << std::endl;
-            }
-        }
-    }
+    // The whole input file decoded, the glyphs of a font share it. Safe to call from any thread.
+    BitmapHandle loadSource() const { return makeBitmapHandle(loadBitmap(0)); }
 
-protected:
-    void parseDimension()
+    // The image as it goes in the atlas, from what loadSource() returned
+    BitmapHandle cutImage(const BitmapHandle& source) const
     {
-        resetSeek();
-
-        mWidth = mHeight = 0;
-        std::string line;
-
-        GlyphData glyphs;
+        if (!isFont()) return source;
 
-        while (!mFile.eof())
-        {
-            std::getline(mFile, line);
-            if (line.find("glyph_") != std::string::npos)
-            {
-                glyphs.extractFromLine(line);
-
-                unsigned w = glyphs.x() + glyphs.w();
-                if (w > mWidth) mWidth = w;
+        // A glyph is cut from the sheet, a whole font is cropped to its glyphs
+        BitmapHandle bitmap = makeBitmapHandle(FreeImage_Copy(source.get(), mSourceX, mSourceY, mSourceX + mWidth, mSourceY + mHeight));
+        if (!bitmap) throw std::runtime_error("Error cropping font image:"+mName);
+        return bitmap;
+    }
 
-                unsigned h = glyphs.y() + glyphs.h();
-                if (h > mHeight) mHeight = h;
-            }
-        }
+    // Pixels of the image, decoded again when they were not kept
+    RgbaImage decodePixels() const
+    {
+        if (*mPixels) return RgbaImage(getImage().get());
+        return RgbaImage(cutImage(loadSource()).get());
     }
 
-    void appendInfo(std::ofstream& outFile, const std::string& info)
+protected:
+    // From the bundle or the file system, 'flags' is passed to FreeImage
+    FIBITMAP* loadBitmap(int flags) const
     {
-        resetSeek();
+        FIBITMAP* bitmap = NULL;
 
-        std::string line;
-        while (!mFile.eof())
+        if (mName == g_whitepixel_name)
         {
-            std::getline(mFile, line);
-            if (line.find(info) != std::string::npos) 
-            {
-                outFile << line << std::endl;
-                break;
-            }
+            bitmap = FreeImage_Allocate(g_whitepixel_size, g_whitepixel_size, 32);
+            if (!bitmap) throw std::runtime_error("Error creating white pixel");
+            BYTE white[] = {0xff, 0xff, 0xff, 0xff};
+            FreeImage_FillBackground(bitmap, white, 0);
+            return bitmap;
         }
-    }
 
-    void resetSeek()
-    {
-        mFile.clear();
-        mFile.seekg(0, std::ios::beg);
-    }
-
-    unsigned mWidth;
-    unsigned mHeight;
-    std::ifstream mFile;
-};
+        if (mBundle)
+        {
+            const BundleEntry* entry = mBundle->find(mName);
+            if (!entry) throw std::runtime_error("Input image not in bundle:"+mName);
 
+            // FreeImage only reads from the stream, the mapping is read-only
+            FIMEMORY* stream = FreeImage_OpenMemory(const_cast<BYTE*>(entry->data), (DWORD)entry->size);
+            if (!stream) throw std::runtime_error("Error loading input image:"+mName);
 
-// Your data - whatever you want to associate with 'rectangle'
-class MyContent
-{
-public:
-    MyContent(const std::string& name) : mName(name), mBitmap(NULL), mFontParser(NULL)
-    {
-        if (name == g_whitepixel_name)
-        {
-            mBitmap = FreeImage_Allocate(g_whitepixel_size, g_whitepixel_size, 32);
-            if (!mBitmap) throw std::runtime_error("Error creating white pixel");
-            BYTE white[] = {0xff, 0xff, 0xff, 0xff};
-            FreeImage_FillBackground(mBitmap, white, 0);
-            mWidth = mHeight = g_whitepixel_size;
+            FREE_IMAGE_FORMAT fmt = FreeImage_GetFileTypeFromMemory(stream, 0);
+            if (fmt != FIF_UNKNOWN) bitmap = FreeImage_LoadFromMemory(fmt, stream, flags);
+            FreeImage_CloseMemory(stream);
         }
         else
         {
             FREE_IMAGE_FORMAT fmt = FreeImage_GetFileType(mName.c_str(), 0);
             if (fmt == FIF_UNKNOWN) throw std::runtime_error("Error loading input image:"+mName);
 
-            mBitmap = FreeImage_Load(fmt, mName.c_str(), 0);
-
-            mWidth = FreeImage_GetWidth(mBitmap);
-            mHeight = FreeImage_GetHeight(mBitmap);
-
-            initFontParser();
+            bitmap = FreeImage_Load(fmt, mName.c_str(), flags);
         }
 
-        std::cout<<"New image loaded: "<<getName()<<" - width:"<<getWidth()<<" - height:"<<getHeight()<<std::endl;
+        if (!bitmap) throw std::runtime_error("Error loading input image:"+mName);
+        return bitmap;
     }
 
-    void appendGorilla(std::ofstream& file, const BinPack2D::Content<MyContent>& content)
+    void initBitmap(FIBITMAP* bitmap, bool keepPixels)
     {
-        if (isFont())
-        {
-            mFontParser->appendGorilla(file, content.coord.x, content.coord.y);
-        }
-        else
-        {
-            file << stripExtension(stripPath(mName)) << " ";
-            file << content.coord.x << " ";
-            file << content.coord.y << " ";
-            file << content.size.w << " ";
-            file << content.size.h << " ";
-            file << std::endl;
-        }
-    }
+        BitmapHandle handle = makeBitmapHandle(bitmap);
+        mWidth = FreeImage_GetWidth(bitmap);
+        mHeight = FreeImage_GetHeight(bitmap);
 
-    bool isFont() const { return mFontParser; }
-    const std::string& getName() const { return mName; }
-    unsigned getWidth() const { return mWidth; }
-    unsigned getHeight() const { return mHeight; }
-    const FIBITMAP* getBitmap() const { return mBitmap; }
+        if (keepPixels) *mPixels = handle;
+    }
 
-protected:
-    void initFontParser()
+    void initFontParser(GorillaFontParser* parser)
     {
-        mFontParser = new GorillaFontParser(mName);
-        if (!mFontParser->isLoaded())
-        {
-            // Assume this file is not a font
-            delete mFontParser;
-            mFontParser = NULL;
-            return;
-        }
+        std::shared_ptr<GorillaFontParser> handle(parser);
+
+        // Assume this file is not a font
+        if (!handle->isLoaded()) return;
+
+        mFontParser = handle;
 
         // Update size using font data
         mWidth = mFontParser->getWidth();
         mHeight = mFontParser->getHeight();
 
         // Crop using new dimensions
-        FIBITMAP* croppedBitmap = FreeImage_Copy(mBitmap, 0,0,mWidth,mHeight);
-        FreeImage_Unload(mBitmap);
-        mBitmap = croppedBitmap;
+        if (!*mPixels) return;
+        *mPixels = makeBitmapHandle(FreeImage_Copy(mPixels->get(), 0,0,mWidth,mHeight));
+        if (!*mPixels) throw std::runtime_error("Error cropping font image:"+mName);
     }
 
     std::string mName;
-    FIBITMAP* mBitmap;
-    GorillaFontParser* mFontParser;
+    std::shared_ptr<BitmapHandle> mPixels; // Shared by the copies, so releasing frees the image
+    std::shared_ptr<GorillaFontParser> mFontParser;
+    std::shared_ptr<const BinPack2D::Mask> mMask;
+    std::string mGroup;
+    const InputBundle* mBundle;
+    bool mGlyph; // Glyph of a font, mSourceX/Y is its place in the sheet
+    int mGlyphCode;
+    unsigned mSourceX;
+    unsigned mSourceY;
     unsigned mWidth;
     unsigned mHeight;
 };
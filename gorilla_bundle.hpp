@@ -0,0 +1,267 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <FreeImage.h>
+
+#include <map>
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+struct BundleEntry
+{
+    const BYTE* data;
+    std::size_t size;
+};
+
+
+// Files of an uncompressed tar or zip archive, mapped once and read in place.
+//
+// Only regular files are listed. Zip entries must be stored (zip -0), a deflated
+// entry is an error rather than a silent extraction to memory.
+class InputBundle
+{
+public:
+    InputBundle(const std::string& filename) : mFilename(filename), mData(NULL), mSize(0)
+    {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Error opening bundle:"+filename);
+
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+        {
+            close(fd);
+            throw std::runtime_error("Error reading bundle:"+filename);
+        }
+
+        mSize = info.st_size;
+        if (mSize)
+        {
+            void* data = mmap(NULL, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED)
+            {
+                close(fd);
+                throw std::runtime_error("Error mapping bundle:"+filename);
+            }
+            mData = (const BYTE*)data;
+            madvise(data, mSize, MADV_WILLNEED);
+        }
+        close(fd);
+
+        try
+        {
+            if (mSize >= 4 && readLE32(mData) == 0x04034b50) parseZip();
+            else parseTar();
+        }
+        catch (...)
+        {
+            unmap();
+            throw;
+        }
+    }
+
+    ~InputBundle() { unmap(); }
+
+    // NULL when the bundle has no such file
+    const BundleEntry* find(const std::string& name) const
+    {
+        std::map<std::string, BundleEntry>::const_iterator it = mEntries.find(name);
+        return it == mEntries.end() ? NULL : &it->second;
+    }
+
+    // File names in archive order
+    const std::vector<std::string>& getNames() const { return mNames; }
+
+protected:
+    // Mapped memory can't be shared by copies
+    InputBundle(const InputBundle&);
+    InputBundle& operator=(const InputBundle&);
+
+    void unmap()
+    {
+        if (mData) munmap(const_cast<BYTE*>(mData), mSize);
+        mData = NULL;
+    }
+
+    void addEntry(std::string name, std::size_t offset, std::size_t size)
+    {
+        if (offset > mSize || size > mSize - offset) throw std::runtime_error("Truncated bundle:"+mFilename);
+
+        while (name.compare(0, 2, "./") == 0) name.erase(0, 2);
+        if (name.empty() || name[name.size() - 1] == '/') return;
+
+        BundleEntry entry = { mData + offset, size };
+        if (mEntries.insert(std::make_pair(name, entry)).second) mNames.push_back(name);
+    }
+
+    // "length key=value\n" records of a pax header, the values of 'path' and 'size' are kept
+    void parsePax(const char* records, std::size_t size, std::string& path, std::string& paxSize)
+    {
+        for (std::size_t offset = 0; offset < size; )
+        {
+            char* end = NULL;
+            std::size_t length = strtoul(records + offset, &end, 10);
+            const char* record = records + offset;
+            if (!length || length > size - offset || end >= record + length || *end != ' ' || record[length - 1] != '\n')
+            {
+                throw std::runtime_error("Corrupt pax header:"+mFilename);
+            }
+
+            std::string field((const char*)end + 1, record + length - 1);
+            std::size_t equal = field.find('=');
+            if (equal == std::string::npos) throw std::runtime_error("Corrupt pax header:"+mFilename);
+
+            std::string key = field.substr(0, equal);
+            if (key == "path") path = field.substr(equal + 1);
+            else if (key == "size") paxSize = field.substr(equal + 1);
+
+            offset += length;
+        }
+    }
+
+    void parseTar()
+    {
+        std::string longName;
+        std::string paxSize;
+
+        for (std::size_t offset = 0; offset + 512 <= mSize; )
+        {
+            const char* header = (const char*)mData + offset;
+            if (!header[0]) break; // End of archive
+
+            std::size_t size = strtoul(std::string(header + 124, 12).c_str(), NULL, 8);
+            char type = header[156];
+            offset += 512;
+
+            if ((type == 'L' || type == 'x' || type == 'g') && offset + size > mSize)
+            {
+                throw std::runtime_error("Truncated bundle:"+mFilename);
+            }
+
+            if (type == 'L')
+            {
+                // GNU long name, applies to the next header
+                longName.assign((const char*)mData + offset, strnlen((const char*)mData + offset, size));
+            }
+            else if (type == 'x')
+            {
+                // pax extended header (Python's tarfile, bsdtar, tar --format=posix), applies to the next header
+                parsePax((const char*)mData + offset, size, longName, paxSize);
+            }
+            else if (type == 'g')
+            {
+                // pax global header, a path in it would rename every entry
+                std::string path, ignored;
+                parsePax((const char*)mData + offset, size, path, ignored);
+                if (!path.empty()) throw std::runtime_error("Unsupported pax global path in bundle:"+mFilename);
+            }
+            else if (type == 'N')
+            {
+                throw std::runtime_error("Unsupported old GNU long names in bundle:"+mFilename);
+            }
+            else if (type == '0' || type == '\0')
+            {
+                if (!paxSize.empty()) size = strtoull(paxSize.c_str(), NULL, 10);
+
+                std::string name;
+                if (!longName.empty()) name = longName;
+                else
+                {
+                    // ustar splits long paths in a prefix and a name
+                    name.assign(header, strnlen(header, 100));
+                    if (!memcmp(header + 257, "ustar", 5) && header[345])
+                    {
+                        name = std::string(header + 345, strnlen(header + 345, 155)) + "/" + name;
+                    }
+                }
+                addEntry(name, offset, size);
+                longName.clear();
+                paxSize.clear();
+            }
+            else
+            {
+                longName.clear();
+                paxSize.clear();
+            }
+
+            offset += (size + 511) / 512 * 512;
+        }
+    }
+
+    void parseZip()
+    {
+        // End of central directory, before an optional comment of up to 64 KiB
+        if (mSize < 22) throw std::runtime_error("Truncated bundle:"+mFilename);
+
+        std::size_t end = mSize - 22;
+        std::size_t stop = end > 0xffff ? end - 0xffff : 0;
+        while (readLE32(mData + end) != 0x06054b50)
+        {
+            if (end == stop) throw std::runtime_error("Zip central directory not found:"+mFilename);
+            end--;
+        }
+
+        unsigned count = readLE16(mData + end + 10);
+        std::size_t offset = readLE32(mData + end + 16);
+
+        for (unsigned i = 0; i < count; i++)
+        {
+            if (offset + 46 > mSize || readLE32(mData + offset) != 0x02014b50) throw std::runtime_error("Corrupt zip bundle:"+mFilename);
+
+            const BYTE* header = mData + offset;
+            unsigned method = readLE16(header + 10);
+            std::size_t size = readLE32(header + 20);
+            unsigned nameLength = readLE16(header + 28);
+            std::size_t local = readLE32(header + 42);
+            if (offset + 46 + nameLength > mSize) throw std::runtime_error("Corrupt zip bundle:"+mFilename);
+            std::string name((const char*)header + 46, nameLength);
+
+            offset += 46 + nameLength + readLE16(header + 30) + readLE16(header + 32);
+
+            if (name.empty() || name[name.size() - 1] == '/') continue;
+            if (method != 0) throw std::runtime_error("Compressed entry in zip bundle, store it uncompressed:"+name);
+
+            // The local header can have a different extra field than the central one
+            if (local + 30 > mSize || readLE32(mData + local) != 0x04034b50) throw std::runtime_error("Corrupt zip bundle:"+mFilename);
+            addEntry(name, local + 30 + readLE16(mData + local + 26) + readLE16(mData + local + 28), size);
+        }
+    }
+
+    static unsigned readLE16(const BYTE* p) { return p[0] | p[1] << 8; }
+    static unsigned readLE32(const BYTE* p) { return p[0] | p[1] << 8 | p[2] << 16 | (unsigned)p[3] << 24; }
+
+    std::string mFilename;
+    const BYTE* mData;
+    std::size_t mSize;
+    std::map<std::string, BundleEntry> mEntries;
+    std::vector<std::string> mNames;
+};
@@ -0,0 +1,313 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include "gorilla_image.hpp"
+
+#include <algorithm>
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+
+// .gatlas, a raw atlas meant to be mapped in memory and used in place.
+//
+// Every field is little endian. The file starts with a ContainerHeader, followed by the
+// level table (pageCount * mipCount ContainerLevel, page major, largest level first).
+// Each page's pixel data follows, every level starting on a 64 bytes boundary, then the
+// sprite, font and glyph tables and the string table holding the names (zero terminated).
+// Coordinates in the tables are in texels of the largest level, top-down.
+
+enum { CONTAINER_MAGIC = 0x4c544147, CONTAINER_VERSION = 1, CONTAINER_ALIGNMENT = 64 }; // "GATL"
+
+// Texel format of the file, numbered on its own so changes to TextureFormat don't change the file
+enum ContainerFormat
+{
+    CONTAINER_FORMAT_A8 = 2,
+    CONTAINER_FORMAT_LA88 = 3,
+    CONTAINER_FORMAT_RGB565 = 4,
+    CONTAINER_FORMAT_RGBA4444 = 5,
+    CONTAINER_FORMAT_RGBA8888 = 6,
+    CONTAINER_FORMAT_BC1 = 7,
+    CONTAINER_FORMAT_BC3 = 8
+};
+
+
+inline ContainerFormat getContainerFormat(TextureFormat format)
+{
+    switch (format)
+    {
+        case TEXTURE_FORMAT_A8: return CONTAINER_FORMAT_A8;
+        case TEXTURE_FORMAT_LA88: return CONTAINER_FORMAT_LA88;
+        case TEXTURE_FORMAT_RGB565: return CONTAINER_FORMAT_RGB565;
+        case TEXTURE_FORMAT_RGBA4444: return CONTAINER_FORMAT_RGBA4444;
+        case TEXTURE_FORMAT_RGBA8888: return CONTAINER_FORMAT_RGBA8888;
+        case TEXTURE_FORMAT_BC1: return CONTAINER_FORMAT_BC1;
+        case TEXTURE_FORMAT_BC3: return CONTAINER_FORMAT_BC3;
+        default: throw std::runtime_error(std::string("No container format for:")+getTextureFormatName(format));
+    }
+}
+
+
+struct ContainerHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;        // ContainerFormat
+    uint32_t pageCount;
+    uint32_t mipCount;
+    uint32_t whitepixelX;
+    uint32_t whitepixelY;
+    uint32_t spriteCount;
+    uint32_t fontCount;
+    uint32_t glyphCount;
+    uint64_t levelTableOffset;
+    uint64_t spriteTableOffset;
+    uint64_t fontTableOffset;
+    uint64_t glyphTableOffset;
+    uint64_t stringTableOffset;
+    uint64_t stringTableSize;
+    uint32_t reserved[8];
+};
+
+
+struct ContainerLevel
+{
+    uint64_t offset;
+    uint64_t size;
+    uint32_t width;
+    uint32_t height;
+};
+
+
+struct ContainerSprite
+{
+    uint32_t name; // Offset in the string table
+    uint32_t page;
+    uint32_t x, y, w, h;
+};
+
+
+struct ContainerFont
+{
+    uint32_t name; // N of [Font.N]
+    uint32_t page;
+    uint32_t lineHeight, spaceLength;
+    int32_t baseline, kerning, letterSpacing; // Negative in some fonts
+    uint32_t monoWidth;
+    uint32_t rangeFirst, rangeLast;
+    uint32_t firstGlyph, glyphCount; // Slice of the glyph table
+};
+
+
+struct ContainerGlyph
+{
+    uint32_t code;
+    uint32_t x, y, w, h;
+    int32_t verticalOffset;
+};
+
+
+static_assert(sizeof(ContainerHeader) == 128 && sizeof(ContainerLevel) == 24, "Container layout changed");
+
+
+class AtlasContainer
+{
+public:
+    AtlasContainer(TextureFormat format, unsigned width, unsigned height)
+    {
+        memset(&mHeader, 0, sizeof(mHeader));
+        mHeader.magic = CONTAINER_MAGIC;
+        mHeader.version = CONTAINER_VERSION;
+        mHeader.width = width;
+        mHeader.height = height;
+        mHeader.format = getContainerFormat(format);
+    }
+
+    // Encoded levels of the next page, largest first. Every page has the same level count.
+    void addPage(const std::vector<std::vector<BYTE> >& levels)
+    {
+        if (levels.empty()) throw std::runtime_error("No image data to write");
+        if (!mPages.empty() && levels.size() != mPages[0].size()) throw std::runtime_error("Pages have different mip counts");
+        mPages.push_back(levels);
+    }
+
+    void setWhitepixel(unsigned x, unsigned y)
+    {
+        mHeader.whitepixelX = x;
+        mHeader.whitepixelY = y;
+    }
+
+    void addSprite(const std::string& name, unsigned page, unsigned x, unsigned y, unsigned w, unsigned h)
+    {
+        ContainerSprite sprite = { addString(name), page, x, y, w, h };
+        mSprites.push_back(sprite);
+    }
+
+    // Glyphs added until the next addFont belong to this font.
+    ContainerFont& addFont(const std::string& name, unsigned page)
+    {
+        ContainerFont font;
+        memset(&font, 0, sizeof(font));
+        font.name = addString(name);
+        font.page = page;
+        font.firstGlyph = (uint32_t)mGlyphs.size();
+        mFonts.push_back(font);
+        return mFonts.back();
+    }
+
+    void addGlyph(const ContainerGlyph& glyph)
+    {
+        if (mFonts.empty()) throw std::runtime_error("Glyph added before its font");
+        mGlyphs.push_back(glyph);
+        mFonts.back().glyphCount++;
+    }
+
+    // One write for the header and level table, one per page and one for the tables.
+    void write(const std::string& filename)
+    {
+        unsigned mipCount = mPages.empty() ? 0 : (unsigned)mPages[0].size();
+
+        mHeader.pageCount = (uint32_t)mPages.size();
+        mHeader.mipCount = mipCount;
+        mHeader.spriteCount = (uint32_t)mSprites.size();
+        mHeader.fontCount = (uint32_t)mFonts.size();
+        mHeader.glyphCount = (uint32_t)mGlyphs.size();
+        mHeader.levelTableOffset = sizeof(ContainerHeader);
+
+        // Layout
+        std::vector<ContainerLevel> levelTable;
+        uint64_t offset = align(mHeader.levelTableOffset + mPages.size() * mipCount * sizeof(ContainerLevel));
+
+        for (std::size_t page = 0; page < mPages.size(); page++)
+        {
+            for (unsigned level = 0; level < mipCount; level++)
+            {
+                ContainerLevel entry;
+                entry.offset = offset;
+                entry.size = mPages[page][level].size();
+                entry.width = std::max(1u, mHeader.width >> level);
+                entry.height = std::max(1u, mHeader.height >> level);
+                levelTable.push_back(entry);
+
+                offset = align(offset + entry.size);
+            }
+        }
+
+        mHeader.spriteTableOffset = offset;
+        mHeader.fontTableOffset = mHeader.spriteTableOffset + mSprites.size() * sizeof(ContainerSprite);
+        mHeader.glyphTableOffset = mHeader.fontTableOffset + mFonts.size() * sizeof(ContainerFont);
+        mHeader.stringTableOffset = mHeader.glyphTableOffset + mGlyphs.size() * sizeof(ContainerGlyph);
+        mHeader.stringTableSize = mStrings.size();
+
+        int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) throw std::runtime_error("Error opening output file:"+filename);
+
+        try
+        {
+            std::vector<BYTE> buffer;
+
+            // Header and level table
+            append(buffer, &mHeader, sizeof(mHeader));
+            if (!levelTable.empty()) append(buffer, &levelTable[0], levelTable.size() * sizeof(ContainerLevel));
+            buffer.resize(align(buffer.size()), 0);
+            writeAll(fd, buffer, filename);
+
+            // Pages, padding included so the next one stays aligned
+            for (std::size_t page = 0; page < mPages.size(); page++)
+            {
+                buffer.clear();
+                for (unsigned level = 0; level < mipCount; level++)
+                {
+                    const std::vector<BYTE>& data = mPages[page][level];
+                    if (!data.empty()) append(buffer, &data[0], data.size());
+                    buffer.resize(align(buffer.size()), 0);
+                }
+                writeAll(fd, buffer, filename);
+            }
+
+            // Tables
+            buffer.clear();
+            if (!mSprites.empty()) append(buffer, &mSprites[0], mSprites.size() * sizeof(ContainerSprite));
+            if (!mFonts.empty()) append(buffer, &mFonts[0], mFonts.size() * sizeof(ContainerFont));
+            if (!mGlyphs.empty()) append(buffer, &mGlyphs[0], mGlyphs.size() * sizeof(ContainerGlyph));
+            if (!mStrings.empty()) append(buffer, &mStrings[0], mStrings.size());
+            writeAll(fd, buffer, filename);
+        }
+        catch (...)
+        {
+            close(fd);
+            throw;
+        }
+
+        if (close(fd) != 0) throw std::runtime_error("Error writing output file:"+filename);
+    }
+
+protected:
+    static uint64_t align(uint64_t offset)
+    {
+        return (offset + CONTAINER_ALIGNMENT - 1) / CONTAINER_ALIGNMENT * CONTAINER_ALIGNMENT;
+    }
+
+    static void append(std::vector<BYTE>& buffer, const void* data, std::size_t size)
+    {
+        const BYTE* bytes = (const BYTE*)data;
+        buffer.insert(buffer.end(), bytes, bytes + size);
+    }
+
+    // A single write unless the kernel returns early
+    static void writeAll(int fd, const std::vector<BYTE>& buffer, const std::string& filename)
+    {
+        std::size_t done = 0;
+        while (done < buffer.size())
+        {
+            ssize_t written = ::write(fd, &buffer[done], buffer.size() - done);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) throw std::runtime_error("Error writing output file:"+filename);
+            done += written;
+        }
+    }
+
+    uint32_t addString(const std::string& value)
+    {
+        uint32_t offset = (uint32_t)mStrings.size();
+        mStrings.insert(mStrings.end(), value.begin(), value.end());
+        mStrings.push_back('\0');
+        return offset;
+    }
+
+    ContainerHeader mHeader;
+    std::vector<std::vector<std::vector<BYTE> > > mPages;
+    std::vector<ContainerSprite> mSprites;
+    std::vector<ContainerFont> mFonts;
+    std::vector<ContainerGlyph> mGlyphs;
+    std::vector<char> mStrings;
+};
@@ -0,0 +1,143 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include "gorilla_image.hpp"
+
+#include <vector>
+
+
+// RGBA8 to the reduced uncompressed formats.
+//
+// Every kernel is a branchless loop over a row with restrict pointers, which the compiler turns
+// into SIMD code at -O3. Channels are rounded, not truncated.
+
+
+namespace Convert
+{
+
+inline BYTE quantize(unsigned value, unsigned bits)
+{
+    unsigned max = (1u << bits) - 1;
+    return (BYTE)((value * max + 127) / 255);
+}
+
+
+inline void rowToA8(const BYTE* __restrict src, BYTE* __restrict dst, unsigned width)
+{
+    for (unsigned x = 0; x < width; x++) dst[x] = src[x*4 + 3];
+}
+
+
+inline void rowToLA88(const BYTE* __restrict src, BYTE* __restrict dst, unsigned width)
+{
+    for (unsigned x = 0; x < width; x++)
+    {
+        dst[x*2 + 0] = src[x*4 + 0];
+        dst[x*2 + 1] = src[x*4 + 3];
+    }
+}
+
+
+inline void rowToRGB565(const BYTE* __restrict src, BYTE* __restrict dst, unsigned width)
+{
+    for (unsigned x = 0; x < width; x++)
+    {
+        unsigned texel = quantize(src[x*4 + 0], 5) << 11 | quantize(src[x*4 + 1], 6) << 5 | quantize(src[x*4 + 2], 5);
+        dst[x*2 + 0] = (BYTE)texel;
+        dst[x*2 + 1] = (BYTE)(texel >> 8);
+    }
+}
+
+
+inline void rowToRGBA4444(const BYTE* __restrict src, BYTE* __restrict dst, unsigned width)
+{
+    for (unsigned x = 0; x < width; x++)
+    {
+        unsigned texel = quantize(src[x*4 + 3], 4) << 12 | quantize(src[x*4 + 0], 4) << 8 |
+                         quantize(src[x*4 + 1], 4) << 4 | quantize(src[x*4 + 2], 4);
+        dst[x*2 + 0] = (BYTE)texel;
+        dst[x*2 + 1] = (BYTE)(texel >> 8);
+    }
+}
+
+} // namespace Convert
+
+
+// Tightly packed texels of 'format', rows top to bottom.
+inline void convertImage(const RgbaImage& image, TextureFormat format, std::vector<BYTE>& output)
+{
+    unsigned width = image.getWidth();
+    unsigned rowSize = width * getTexelSize(format);
+
+    output.resize(rowSize * image.getHeight());
+    if (output.empty()) return;
+
+    for (unsigned y = 0; y < image.getHeight(); y++)
+    {
+        const BYTE* src = image.getRow(y);
+        BYTE* dst = &output[y * rowSize];
+
+        switch (format)
+        {
+            case TEXTURE_FORMAT_A8: Convert::rowToA8(src, dst, width); break;
+            case TEXTURE_FORMAT_LA88: Convert::rowToLA88(src, dst, width); break;
+            case TEXTURE_FORMAT_RGB565: Convert::rowToRGB565(src, dst, width); break;
+            case TEXTURE_FORMAT_RGBA4444: Convert::rowToRGBA4444(src, dst, width); break;
+            case TEXTURE_FORMAT_RGBA8888: memcpy(dst, src, rowSize); break;
+            default: throw std::runtime_error("Not an uncompressed format");
+        }
+    }
+}
+
+
+// A8 when every visible texel is white (font sheets), LA88 when they are all gray, else RGBA8888.
+inline TextureFormat detectTextureFormat(const RgbaImage& image)
+{
+    bool white = true;
+    bool gray = true;
+
+    for (unsigned y = 0; y < image.getHeight() && gray; y++)
+    {
+        const BYTE* row = image.getRow(y);
+
+        // Accumulate over the row without early exit so the loop stays vectorizable.
+        unsigned notWhite = 0;
+        unsigned notGray = 0;
+        for (unsigned x = 0; x < image.getWidth(); x++)
+        {
+            const BYTE* texel = row + x*4;
+            unsigned visible = texel[3] != 0;
+            notWhite |= visible & ((texel[0] & texel[1] & texel[2]) != 0xff);
+            notGray |= visible & ((texel[0] != texel[1]) | (texel[1] != texel[2]));
+        }
+
+        white = white && !notWhite;
+        gray = gray && !notGray;
+    }
+
+    if (white) return TEXTURE_FORMAT_A8;
+    if (gray) return TEXTURE_FORMAT_LA88;
+    return TEXTURE_FORMAT_RGBA8888;
+}
@@ -0,0 +1,108 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include "gorilla_image.hpp"
+
+#include <fstream>
+#include <string>
+#include <stdexcept>
+#include <vector>
+
+
+// Write a DDS file. 'levels' holds the encoded data of each mip level, largest first.
+inline void writeDDS(const std::string& filename, TextureFormat format, unsigned width, unsigned height,
+              const std::vector<std::vector<BYTE> >& levels)
+{
+    enum
+    {
+        DDSD_CAPS = 0x1, DDSD_HEIGHT = 0x2, DDSD_WIDTH = 0x4, DDSD_PITCH = 0x8, DDSD_PIXELFORMAT = 0x1000,
+        DDSD_MIPMAPCOUNT = 0x20000, DDSD_LINEARSIZE = 0x80000,
+        DDPF_ALPHAPIXELS = 0x1, DDPF_ALPHA = 0x2, DDPF_FOURCC = 0x4, DDPF_RGB = 0x40, DDPF_LUMINANCE = 0x20000,
+        DDSCAPS_COMPLEX = 0x8, DDSCAPS_TEXTURE = 0x1000, DDSCAPS_MIPMAP = 0x400000
+    };
+
+    if (levels.empty()) throw std::runtime_error("No image data to write");
+
+    DWORD header[32];
+    memset(header, 0, sizeof(header));
+
+    header[0] = 0x20534444; // "DDS "
+    header[1] = 124;        // Header size
+    header[2] = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT;
+    header[3] = height;
+    header[4] = width;
+    header[7] = (DWORD)levels.size();
+
+    if (isBlockCompressed(format))
+    {
+        header[2] |= DDSD_LINEARSIZE;
+        header[5] = (DWORD)levels[0].size();
+    }
+    else
+    {
+        header[2] |= DDSD_PITCH;
+        header[5] = width * getTexelSize(format);
+    }
+
+    // Pixel format: size, flags, fourCC, bit count, R, G, B, A masks
+    DWORD* pf = &header[19];
+    pf[0] = 32;
+    switch (format)
+    {
+        case TEXTURE_FORMAT_BC1: pf[1] = DDPF_FOURCC; pf[2] = 0x31545844; break; // "DXT1"
+        case TEXTURE_FORMAT_BC3: pf[1] = DDPF_FOURCC; pf[2] = 0x35545844; break; // "DXT5"
+        case TEXTURE_FORMAT_A8:
+            pf[1] = DDPF_ALPHA; pf[3] = 8; pf[7] = 0xff; break;
+        case TEXTURE_FORMAT_LA88:
+            pf[1] = DDPF_LUMINANCE | DDPF_ALPHAPIXELS; pf[3] = 16; pf[4] = 0x00ff; pf[7] = 0xff00; break;
+        case TEXTURE_FORMAT_RGB565:
+            pf[1] = DDPF_RGB; pf[3] = 16; pf[4] = 0xf800; pf[5] = 0x07e0; pf[6] = 0x001f; break;
+        case TEXTURE_FORMAT_RGBA4444:
+            pf[1] = DDPF_RGB | DDPF_ALPHAPIXELS; pf[3] = 16;
+            pf[4] = 0x0f00; pf[5] = 0x00f0; pf[6] = 0x000f; pf[7] = 0xf000; break;
+        case TEXTURE_FORMAT_RGBA8888:
+            pf[1] = DDPF_RGB | DDPF_ALPHAPIXELS; pf[3] = 32;
+            pf[4] = 0x000000ff; pf[5] = 0x0000ff00; pf[6] = 0x00ff0000; pf[7] = 0xff000000; break;
+        default: throw std::runtime_error("Format not supported by the DDS writer");
+    }
+
+    header[27] = DDSCAPS_TEXTURE;
+    if (levels.size() > 1)
+    {
+        header[2] |= DDSD_MIPMAPCOUNT;
+        header[27] |= DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+    }
+
+    std::ofstream file(filename.c_str(), std::ios::binary);
+    if (!file.is_open()) throw std::runtime_error("Error opening output file:"+filename);
+
+    file.write((const char*)header, sizeof(header));
+    for (std::vector<std::vector<BYTE> >::const_iterator it = levels.begin(); it != levels.end(); it++)
+    {
+        if (!it->empty()) file.write((const char*)&(*it)[0], it->size());
+    }
+
+    if (!file.good()) throw std::runtime_error("Error writing output file:"+filename);
+}
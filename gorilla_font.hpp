@@ -0,0 +1,333 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Font sidecar (.gorilla next to the font image) and the filename helpers it needs. Free of the
+// packer's globals, shared by the tool and the library.
+
+
+class GlyphData
+{
+public:
+    int x() { return values[0]; }
+    int y() { return values[1]; }
+    int w() { return values[2]; }
+    int h() { return values[3]; }
+
+    void extractFromLine(const std::string& line)
+    {
+        std::size_t startPos = 0;
+        std::size_t endPos = 0;
+
+        for (unsigned i = 0; i < 4; i++)
+        {
+            startPos = line.find(" ", endPos);
+            endPos = line.find(" ", startPos+1);
+            if (startPos == std::string::npos) throw std::runtime_error("Error extracting glyph data");
+            std::string num = line.substr(startPos, endPos);
+            values[i] = atoi(num.c_str());
+        }
+    }
+
+protected:
+    int values[4];
+};
+
+
+struct FontGlyph
+{
+    int code;
+    int x, y, w, h;
+    int verticalOffset;
+};
+
+
+inline std::string stripPath(const std::string& filename)
+{
+    std::size_t startPos = 0;
+
+    // Nix directory separator
+    std::size_t symbolPos = filename.find_last_of('/');
+    if (symbolPos != std::string::npos) startPos = symbolPos + 1;
+
+    // Windows directory separator
+    symbolPos = filename.find_last_of('\\');
+    if (symbolPos != std::string::npos && symbolPos > startPos) startPos = symbolPos + 1;
+
+    return filename.substr(startPos, std::string::npos);
+}
+
+
+inline std::string stripExtension(const std::string& filename)
+{
+    return filename.substr(0, filename.find_last_of('.'));
+}
+
+
+// Lower case extension without the dot
+inline std::string getExtension(const std::string& filename)
+{
+    std::size_t dotPos = filename.find_last_of('.');
+    if (dotPos == std::string::npos) return "";
+
+    std::string extension = filename.substr(dotPos + 1);
+    for (std::size_t i = 0; i < extension.size(); i++) extension[i] = tolower(extension[i]);
+    return extension;
+}
+
+
+class GorillaFontParser
+{
+public:
+    GorillaFontParser(const std::string& imageFilename) : mLoaded(false)
+    {
+        std::string fn = stripExtension(imageFilename);
+        fn += ".gorilla";
+        std::ifstream file(fn.c_str());
+        if (!file.is_open()) return;
+
+        std::ostringstream text;
+        text << file.rdbuf();
+        init(text.str());
+    }
+
+    // .gorilla text already in memory, from an input bundle
+    GorillaFontParser(const char* data, std::size_t size) : mLoaded(false)
+    {
+        init(std::string(data, size));
+    }
+
+    bool isLoaded() const { return mLoaded; }
+    unsigned getWidth() const { return mWidth; }
+    unsigned getHeight() const { return mHeight; }
+
+    void appendGorilla(std::ostream& outFile, unsigned xOffset, unsigned yOffset)
+    {
+        appendHeader(outFile, xOffset, yOffset);
+
+        resetSeek();
+
+        std::string line;
+        GlyphData glyphs;
+
+        while (!mFile.eof())
+        {
+            std::getline(mFile, line);
+            if (line.find("glyph_") != std::string::npos)
+            {
+                outFile << line.substr(0, line.find(" ")) << " ";
+                glyphs.extractFromLine(line);
+                outFile << glyphs.x() << " ";
+                outFile << glyphs.y() << " ";
+                outFile << glyphs.w() << " ";
+                outFile << glyphs.h() << " ";
+                outFile << std::endl;
+            }
+            else if (line.find("verticaloffset_") != std::string::npos)
+            {
+                outFile << line << std::endl;
+            }
+        }
+    }
+
+    // Glyphs packed one by one, 'positions' maps a glyph code to where it is in the atlas.
+    // Glyphs missing from it are empty and written at 0 0.
+    void appendGorilla(std::ostream& outFile, const std::map<int, std::pair<unsigned, unsigned> >& positions)
+    {
+        appendHeader(outFile, 0, 0);
+
+        std::vector<FontGlyph> glyphs;
+        getGlyphs(glyphs);
+
+        for (std::vector<FontGlyph>::const_iterator it = glyphs.begin(); it != glyphs.end(); it++)
+        {
+            std::map<int, std::pair<unsigned, unsigned> >::const_iterator position = positions.find(it->code);
+            outFile << "glyph_" << it->code << " ";
+            outFile << (position == positions.end() ? 0 : position->second.first) << " ";
+            outFile << (position == positions.end() ? 0 : position->second.second) << " ";
+            outFile << it->w << " ";
+            outFile << it->h << " ";
+            outFile << std::endl;
+        }
+
+        for (std::vector<FontGlyph>::const_iterator it = glyphs.begin(); it != glyphs.end(); it++)
+        {
+            if (it->verticalOffset) outFile << "verticaloffset_" << it->code << " " << it->verticalOffset << std::endl;
+        }
+    }
+
+    // Name of the [Font.N] section
+    std::string getFontName()
+    {
+        std::string line = findLine("[Font.");
+        std::size_t start = line.find('.') + 1;
+        std::size_t end = line.find(']', start);
+        return line.empty() ? "" : line.substr(start, end - start);
+    }
+
+    // Number at 'index' after 'key' on its line, 0 when missing
+    int getValue(const std::string& key, unsigned index = 0)
+    {
+        std::istringstream line(findLine(key + " "));
+        std::string name;
+        line >> name;
+
+        int value = 0;
+        for (unsigned i = 0; i <= index; i++)
+        {
+            if (!(line >> value)) return 0;
+        }
+        return value;
+    }
+
+    // Glyph rectangles in the sheet, with their vertical offset
+    void getGlyphs(std::vector<FontGlyph>& glyphs)
+    {
+        resetSeek();
+        glyphs.clear();
+
+        std::map<int, int> verticalOffsets;
+        std::string line;
+        GlyphData data;
+
+        while (!mFile.eof())
+        {
+            std::getline(mFile, line);
+            if (line.find("glyph_") != std::string::npos)
+            {
+                data.extractFromLine(line);
+                FontGlyph glyph = { atoi(line.c_str() + line.find('_') + 1), data.x(), data.y(), data.w(), data.h(), 0 };
+                glyphs.push_back(glyph);
+            }
+            else if (line.find("verticaloffset_") != std::string::npos)
+            {
+                const char* code = line.c_str() + line.find('_') + 1;
+                verticalOffsets[atoi(code)] = atoi(strchr(code, ' ') ? strchr(code, ' ') : "0");
+            }
+        }
+
+        for (std::vector<FontGlyph>::iterator it = glyphs.begin(); it != glyphs.end(); it++)
+        {
+            std::map<int, int>::const_iterator offset = verticalOffsets.find(it->code);
+            if (offset != verticalOffsets.end()) it->verticalOffset = offset->second;
+        }
+    }
+
+protected:
+    void appendHeader(std::ostream& outFile, unsigned xOffset, unsigned yOffset)
+    {
+        appendInfo(outFile, "[Font.");
+        appendInfo(outFile, "lineheight ");
+        appendInfo(outFile, "spacelength ");
+        appendInfo(outFile, "baseline ");
+        appendInfo(outFile, "kerning ");
+        appendInfo(outFile, "letterspacing ");
+        appendInfo(outFile, "monowidth ");
+        appendInfo(outFile, "range ");
+        outFile << "offset " << xOffset << " " << yOffset << std::endl;
+    }
+
+    void init(const std::string& text)
+    {
+        mFile.str(text);
+        mLoaded = true;
+        parseDimension();
+    }
+
+    std::string findLine(const std::string& info)
+    {
+        resetSeek();
+
+        std::string line;
+        while (!mFile.eof())
+        {
+            std::getline(mFile, line);
+            if (line.find(info) != std::string::npos) return line;
+        }
+        return "";
+    }
+
+    void parseDimension()
+    {
+        resetSeek();
+
+        mWidth = mHeight = 0;
+        std::string line;
+
+        GlyphData glyphs;
+
+        while (!mFile.eof())
+        {
+            std::getline(mFile, line);
+            if (line.find("glyph_") != std::string::npos)
+            {
+                glyphs.extractFromLine(line);
+
+                unsigned w = glyphs.x() + glyphs.w();
+                if (w > mWidth) mWidth = w;
+
+                unsigned h = glyphs.y() + glyphs.h();
+                if (h > mHeight) mHeight = h;
+            }
+        }
+    }
+
+    void appendInfo(std::ostream& outFile, const std::string& info)
+    {
+        resetSeek();
+
+        std::string line;
+        while (!mFile.eof())
+        {
+            std::getline(mFile, line);
+            if (line.find(info) != std::string::npos) 
+            {
+                outFile << line << std::endl;
+                break;
+            }
+        }
+    }
+
+    void resetSeek()
+    {
+        mFile.clear();
+        mFile.seekg(0, std::ios::beg);
+    }
+
+    bool mLoaded;
+    unsigned mWidth;
+    unsigned mHeight;
+    std::istringstream mFile;
+};
@@ -0,0 +1,186 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <FreeImage.h>
+
+#include <memory>
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <string.h>
+
+
+// Pixel layout of the atlas when it is not written through FreeImage_Save.
+enum TextureFormat
+{
+    TEXTURE_FORMAT_DEFAULT, // Whatever FreeImage saves for the output extension
+    TEXTURE_FORMAT_AUTO,    // Smallest uncompressed format holding every input texel
+    TEXTURE_FORMAT_A8,      // Alpha only, color is white
+    TEXTURE_FORMAT_LA88,
+    TEXTURE_FORMAT_RGB565,
+    TEXTURE_FORMAT_RGBA4444,
+    TEXTURE_FORMAT_RGBA8888,
+    TEXTURE_FORMAT_BC1,
+    TEXTURE_FORMAT_BC3
+};
+
+
+inline TextureFormat parseTextureFormat(const std::string& name)
+{
+    if (name == "default") return TEXTURE_FORMAT_DEFAULT;
+    if (name == "auto") return TEXTURE_FORMAT_AUTO;
+    if (name == "a8") return TEXTURE_FORMAT_A8;
+    if (name == "la88") return TEXTURE_FORMAT_LA88;
+    if (name == "rgb565") return TEXTURE_FORMAT_RGB565;
+    if (name == "rgba4444") return TEXTURE_FORMAT_RGBA4444;
+    if (name == "rgba8888") return TEXTURE_FORMAT_RGBA8888;
+    if (name == "bc1" || name == "dxt1") return TEXTURE_FORMAT_BC1;
+    if (name == "bc3" || name == "dxt5") return TEXTURE_FORMAT_BC3;
+    throw std::runtime_error("Unknown texture format:"+name);
+}
+
+
+inline const char* getTextureFormatName(TextureFormat format)
+{
+    switch (format)
+    {
+        case TEXTURE_FORMAT_AUTO: return "auto";
+        case TEXTURE_FORMAT_A8: return "a8";
+        case TEXTURE_FORMAT_LA88: return "la88";
+        case TEXTURE_FORMAT_RGB565: return "rgb565";
+        case TEXTURE_FORMAT_RGBA4444: return "rgba4444";
+        case TEXTURE_FORMAT_RGBA8888: return "rgba8888";
+        case TEXTURE_FORMAT_BC1: return "bc1";
+        case TEXTURE_FORMAT_BC3: return "bc3";
+        default: return "default";
+    }
+}
+
+
+inline bool isBlockCompressed(TextureFormat format)
+{
+    return format == TEXTURE_FORMAT_BC1 || format == TEXTURE_FORMAT_BC3;
+}
+
+
+// Bytes per texel of the uncompressed formats
+inline unsigned getTexelSize(TextureFormat format)
+{
+    switch (format)
+    {
+        case TEXTURE_FORMAT_A8: return 1;
+        case TEXTURE_FORMAT_LA88:
+        case TEXTURE_FORMAT_RGB565:
+        case TEXTURE_FORMAT_RGBA4444: return 2;
+        case TEXTURE_FORMAT_RGBA8888: return 4;
+        default: throw std::runtime_error("Not an uncompressed format");
+    }
+}
+
+
+// Owns a FIBITMAP, unloaded with the last reference
+typedef std::shared_ptr<FIBITMAP> BitmapHandle;
+
+
+inline BitmapHandle makeBitmapHandle(FIBITMAP* bitmap)
+{
+    return bitmap ? BitmapHandle(bitmap, FreeImage_Unload) : BitmapHandle();
+}
+
+
+// 8 bits per channel RGBA image, rows top to bottom (FreeImage stores them bottom to top, in BGRA).
+class RgbaImage
+{
+public:
+    RgbaImage() : mWidth(0), mHeight(0) {}
+
+    RgbaImage(unsigned width, unsigned height) : mWidth(width), mHeight(height), mPixels(width*height*4, 0) {}
+
+    RgbaImage(FIBITMAP* bitmap)
+    {
+        FIBITMAP* converted = NULL;
+        if (FreeImage_GetBPP(bitmap) != 32)
+        {
+            converted = FreeImage_ConvertTo32Bits(bitmap);
+            if (!converted) throw std::runtime_error("Error converting image to 32 bits");
+            bitmap = converted;
+        }
+
+        mWidth = FreeImage_GetWidth(bitmap);
+        mHeight = FreeImage_GetHeight(bitmap);
+        mPixels.resize(mWidth*mHeight*4);
+
+        for (unsigned y = 0; y < mHeight; y++)
+        {
+            const BYTE* src = FreeImage_GetScanLine(bitmap, mHeight - 1 - y);
+            BYTE* dst = getRow(y);
+
+            for (unsigned x = 0; x < mWidth; x++, src += 4, dst += 4)
+            {
+                dst[0] = src[FI_RGBA_RED];
+                dst[1] = src[FI_RGBA_GREEN];
+                dst[2] = src[FI_RGBA_BLUE];
+                dst[3] = src[FI_RGBA_ALPHA];
+            }
+        }
+
+        if (converted) FreeImage_Unload(converted);
+    }
+
+    unsigned getWidth() const { return mWidth; }
+    unsigned getHeight() const { return mHeight; }
+    BYTE* getRow(unsigned y) { return &mPixels[y*mWidth*4]; }
+    const BYTE* getRow(unsigned y) const { return &mPixels[y*mWidth*4]; }
+    const std::vector<BYTE>& getPixels() const { return mPixels; }
+
+protected:
+    unsigned mWidth;
+    unsigned mHeight;
+    std::vector<BYTE> mPixels;
+};
+
+
+// 32 bits FreeImage bitmap of 'image', to save it through FreeImage
+inline BitmapHandle makeBitmap(const RgbaImage& image)
+{
+    BitmapHandle bitmap = makeBitmapHandle(FreeImage_Allocate(image.getWidth(), image.getHeight(), 32));
+    if (!bitmap) throw std::runtime_error("Error creating image");
+
+    for (unsigned y = 0; y < image.getHeight(); y++)
+    {
+        const BYTE* src = image.getRow(y);
+        BYTE* dst = FreeImage_GetScanLine(bitmap.get(), image.getHeight() - 1 - y);
+
+        for (unsigned x = 0; x < image.getWidth(); x++, src += 4, dst += 4)
+        {
+            dst[FI_RGBA_RED] = src[0];
+            dst[FI_RGBA_GREEN] = src[1];
+            dst[FI_RGBA_BLUE] = src[2];
+            dst[FI_RGBA_ALPHA] = src[3];
+        }
+    }
+
+    return bitmap;
+}
@@ -0,0 +1,167 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include "gorilla_image.hpp"
+
+#include <FreeImage.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+#ifdef __SSE2__
+// Four 2x2 blocks of 'row0' and 'row1' to four texels of 'out', when every block has a single
+// alpha value. Alpha weighting then gives the plain average, computed 16 bits per channel.
+// Returns false, writing nothing, when a block mixes alpha values.
+inline bool downsampleUniformBlocks(const BYTE* row0, const BYTE* row1, BYTE* out)
+{
+    for (unsigned i = 0; i < 4; i++)
+    {
+        BYTE alpha = row0[i * 8 + 3];
+        if (row0[i * 8 + 7] != alpha || row1[i * 8 + 3] != alpha || row1[i * 8 + 7] != alpha) return false;
+    }
+
+    __m128i zero = _mm_setzero_si128();
+    __m128i two = _mm_set1_epi16(2);
+    __m128i half[2];
+
+    for (unsigned i = 0; i < 2; i++)
+    {
+        __m128i top = _mm_loadu_si128((const __m128i*)(row0 + i * 16));
+        __m128i bottom = _mm_loadu_si128((const __m128i*)(row1 + i * 16));
+
+        // Texels 0,1 and 2,3 of both rows, 16 bits per channel
+        __m128i low = _mm_add_epi16(_mm_unpacklo_epi8(top, zero), _mm_unpacklo_epi8(bottom, zero));
+        __m128i high = _mm_add_epi16(_mm_unpackhi_epi8(top, zero), _mm_unpackhi_epi8(bottom, zero));
+
+        // Left plus right texel of each block
+        low = _mm_add_epi16(low, _mm_srli_si128(low, 8));
+        high = _mm_add_epi16(high, _mm_srli_si128(high, 8));
+
+        half[i] = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(low, high), two), 2);
+    }
+
+    _mm_storeu_si128((__m128i*)out, _mm_packus_epi16(half[0], half[1]));
+    return true;
+}
+#endif
+
+
+// Half size image, 2x2 box filter. Color is weighted by alpha so transparent texels don't
+// darken the edges. Rows are spread over 'threads' threads (0: one per core), blocks of a single
+// alpha (opaque or clear areas) are averaged four at a time with SSE2.
+inline RgbaImage downsampleImage(const RgbaImage& src, unsigned threads = 0)
+{
+    unsigned width = std::max(1u, src.getWidth() / 2);
+    unsigned height = std::max(1u, src.getHeight() / 2);
+    RgbaImage dst(width, height);
+
+    if (!threads) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, height);
+
+    std::atomic<unsigned> nextRow(0);
+
+    struct Worker
+    {
+        static void run(const RgbaImage* src, RgbaImage* dst, std::atomic<unsigned>* nextRow)
+        {
+            unsigned lastX = src->getWidth() - 1;
+            unsigned lastY = src->getHeight() - 1;
+
+            for (unsigned y = (*nextRow)++; y < dst->getHeight(); y = (*nextRow)++)
+            {
+                const BYTE* row0 = src->getRow(std::min(y * 2, lastY));
+                const BYTE* row1 = src->getRow(std::min(y * 2 + 1, lastY));
+                BYTE* out = dst->getRow(y);
+
+                for (unsigned x = 0; x < dst->getWidth(); x++)
+                {
+#ifdef __SSE2__
+                    if (x + 4 <= dst->getWidth() && x * 2 + 8 <= src->getWidth() &&
+                        downsampleUniformBlocks(row0 + x * 8, row1 + x * 8, out + x * 4))
+                    {
+                        x += 3;
+                        continue;
+                    }
+#endif
+                    unsigned x0 = std::min(x * 2, lastX) * 4;
+                    unsigned x1 = std::min(x * 2 + 1, lastX) * 4;
+
+                    unsigned a00 = row0[x0 + 3], a01 = row0[x1 + 3], a10 = row1[x0 + 3], a11 = row1[x1 + 3];
+                    unsigned alpha = a00 + a01 + a10 + a11;
+
+                    for (unsigned c = 0; c < 3; c++)
+                    {
+                        unsigned weighted = row0[x0 + c] * a00 + row0[x1 + c] * a01 + row1[x0 + c] * a10 + row1[x1 + c] * a11;
+                        unsigned plain = row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c];
+                        out[x * 4 + c] = (BYTE)(alpha ? (weighted + alpha / 2) / alpha : (plain + 2) / 4);
+                    }
+                    out[x * 4 + 3] = (BYTE)((alpha + 2) / 4);
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; i++) workers.push_back(std::thread(Worker::run, &src, &dst, &nextRow));
+    Worker::run(&src, &dst, &nextRow);
+    for (std::vector<std::thread>::iterator it = workers.begin(); it != workers.end(); it++) it->join();
+
+    return dst;
+}
+
+
+// Number of levels of a full chain down to 1x1
+inline unsigned getMipCount(unsigned width, unsigned height)
+{
+    unsigned count = 1;
+    while (width > 1 || height > 1)
+    {
+        width = std::max(1u, width / 2);
+        height = std::max(1u, height / 2);
+        count++;
+    }
+    return count;
+}
+
+
+// 'levels' includes the base image, 0 for the full chain.
+inline void buildMipChain(const RgbaImage& base, unsigned levels, std::vector<RgbaImage>& chain)
+{
+    unsigned fullChain = getMipCount(base.getWidth(), base.getHeight());
+    if (!levels || levels > fullChain) levels = fullChain;
+
+    chain.clear();
+    chain.reserve(levels);
+    chain.push_back(base);
+
+    while (chain.size() < levels) chain.push_back(downsampleImage(chain.back()));
+}
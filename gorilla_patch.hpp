@@ -0,0 +1,186 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include "gorilla_image.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+
+
+// .patch, the rectangles of a page that changed since the previous build, for partial uploads.
+//
+// Every field is little endian. A PatchHeader, then rectCount times a PatchRect followed by its
+// texels (w * h * texelSize bytes, rows top to bottom, padded to 4 bytes), then the new .gorilla
+// of the page (gorillaSize bytes). Texels are in the format of the page image. When the previous
+// page is missing or has another size or format, the patch is the whole page.
+
+enum { PATCH_MAGIC = 0x48435047, PATCH_VERSION = 1 }; // "GPCH"
+
+
+struct PatchHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t page;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;        // TextureFormat
+    uint32_t texelSize;
+    uint32_t rectCount;
+    uint32_t gorillaSize;
+    uint32_t reserved[3];
+};
+
+
+struct PatchRect
+{
+    uint32_t x, y, w, h;
+};
+
+
+static_assert(sizeof(PatchHeader) == 48 && sizeof(PatchRect) == 16, "Patch layout changed");
+
+
+class AtlasPatch
+{
+public:
+    // Texels of both builds, tightly packed. Changes are found by tiles of 'tileSize' texels
+    // and neighbouring changed tiles are merged.
+    AtlasPatch(const std::vector<BYTE>& previous, const std::vector<BYTE>& texels,
+               unsigned width, unsigned height, unsigned texelSize, unsigned tileSize = 32)
+        : mWidth(width), mHeight(height), mTexelSize(texelSize)
+    {
+        if (previous.size() != texels.size())
+        {
+            PatchRect rect = { 0, 0, width, height };
+            if (width && height) mRects.push_back(rect);
+            return;
+        }
+
+        unsigned columns = (width + tileSize - 1) / tileSize;
+        unsigned rows = (height + tileSize - 1) / tileSize;
+
+        // Spans of changed tiles in the tile row above, extended while the next row repeats them
+        std::vector<std::size_t> open;
+
+        for (unsigned row = 0; row < rows; row++)
+        {
+            unsigned y = row * tileSize;
+            unsigned h = std::min(tileSize, height - y);
+
+            std::vector<bool> changed(columns, false);
+            for (unsigned line = y; line < y + h; line++)
+            {
+                std::size_t offset = (std::size_t)line * width * texelSize;
+                for (unsigned column = 0; column < columns; column++)
+                {
+                    if (changed[column]) continue;
+                    unsigned x = column * tileSize;
+                    std::size_t size = std::min(tileSize, width - x) * texelSize;
+                    changed[column] = memcmp(&previous[offset + x * texelSize], &texels[offset + x * texelSize], size) != 0;
+                }
+            }
+
+            std::vector<std::size_t> next;
+            for (unsigned column = 0; column < columns; )
+            {
+                if (!changed[column]) { column++; continue; }
+                unsigned start = column;
+                while (column < columns && changed[column]) column++;
+
+                PatchRect rect = { start * tileSize, y, std::min(column * tileSize, width) - start * tileSize, h };
+
+                std::size_t index = mRects.size();
+                for (std::vector<std::size_t>::const_iterator it = open.begin(); it != open.end(); it++)
+                {
+                    PatchRect& above = mRects[*it];
+                    if (above.x == rect.x && above.w == rect.w && above.y + above.h == y) index = *it;
+                }
+
+                if (index == mRects.size()) mRects.push_back(rect);
+                else mRects[index].h += h;
+                next.push_back(index);
+            }
+            open.swap(next);
+        }
+    }
+
+    std::size_t getRectCount() const { return mRects.size(); }
+
+    std::size_t getTexelCount() const
+    {
+        std::size_t count = 0;
+        for (std::vector<PatchRect>::const_iterator it = mRects.begin(); it != mRects.end(); it++) count += (std::size_t)it->w * it->h;
+        return count;
+    }
+
+    // 'texels' are the ones given to the constructor
+    void write(const std::string& filename, unsigned page, TextureFormat format,
+               const std::vector<BYTE>& texels, const std::string& gorilla) const
+    {
+        std::ofstream file(filename.c_str(), std::ios::binary);
+        if (!file.is_open()) throw std::runtime_error("Error opening output file:"+filename);
+
+        PatchHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = PATCH_MAGIC;
+        header.version = PATCH_VERSION;
+        header.page = page;
+        header.width = mWidth;
+        header.height = mHeight;
+        header.format = format;
+        header.texelSize = mTexelSize;
+        header.rectCount = (uint32_t)mRects.size();
+        header.gorillaSize = (uint32_t)gorilla.size();
+        file.write((const char*)&header, sizeof(header));
+
+        static const char padding[4] = { 0, 0, 0, 0 };
+        for (std::vector<PatchRect>::const_iterator it = mRects.begin(); it != mRects.end(); it++)
+        {
+            file.write((const char*)&*it, sizeof(PatchRect));
+
+            std::size_t rowSize = (std::size_t)it->w * mTexelSize;
+            for (unsigned y = it->y; y < it->y + it->h; y++)
+            {
+                file.write((const char*)&texels[((std::size_t)y * mWidth + it->x) * mTexelSize], rowSize);
+            }
+            file.write(padding, (4 - rowSize * it->h % 4) % 4);
+        }
+
+        file.write(gorilla.data(), gorilla.size());
+        if (!file) throw std::runtime_error("Error writing output file:"+filename);
+    }
+
+protected:
+    unsigned mWidth;
+    unsigned mHeight;
+    unsigned mTexelSize;
+    std::vector<PatchRect> mRects;
+};
@@ -0,0 +1,286 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include "gorilla_binpacker.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Hands items from one stage to the next. push() waits while 'capacity' items are queued, so a
+// fast producer can't run ahead of its consumer by more than that.
+template<typename T>
+class BoundedQueue
+{
+public:
+    BoundedQueue(std::size_t capacity) : mCapacity(std::max<std::size_t>(1, capacity)), mClosed(false) {}
+
+    // False when the queue was closed, the item is dropped
+    bool push(const T& item)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mNotFull.wait(lock, [this] { return mClosed || mItems.size() < mCapacity; });
+        if (mClosed) return false;
+
+        mItems.push_back(item);
+        mNotEmpty.notify_one();
+        return true;
+    }
+
+    // False once the queue is closed and empty
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mNotEmpty.wait(lock, [this] { return mClosed || !mItems.empty(); });
+        if (mItems.empty()) return false;
+
+        item = mItems.front();
+        mItems.pop_front();
+        mNotFull.notify_one();
+        return true;
+    }
+
+    // Wakes both ends, pop() still drains what is queued
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mClosed = true;
+        mNotFull.notify_all();
+        mNotEmpty.notify_all();
+    }
+
+protected:
+    std::size_t mCapacity;
+    bool mClosed;
+    std::deque<T> mItems;
+    std::mutex mMutex;
+    std::condition_variable mNotFull;
+    std::condition_variable mNotEmpty;
+};
+
+
+// Decodes the input images on worker threads while the atlas is packed and composited.
+//
+// Packing only needs the sizes, so the pixels are decoded in the background from the start, in
+// input order. Once the placements are known, schedule() gives the order the compositor takes the
+// images in and the workers follow it. At most 'window' decoded images wait to be taken; the
+// next few the compositor needs are decoded regardless, so an early guess that turned out wrong
+// can't stall it. An image is freed when its last use is taken.
+//
+// Images are keyed by input filename, the glyphs of a font share one decoded sheet.
+class DecodePool
+{
+public:
+    // 'sources' has one content per input file, in the order to decode them before schedule()
+    DecodePool(const std::vector<MyContent>& sources, unsigned threads, std::size_t window)
+        : mWindow(std::max<std::size_t>(1, window)), mAhead(std::max(1u, threads)),
+          mScan(0), mTaken(0), mResident(0), mScheduled(false), mStop(false)
+    {
+        for (std::vector<MyContent>::const_iterator it = sources.begin(); it != sources.end(); it++)
+        {
+            if (mSources.find(it->getName()) != mSources.end()) continue;
+            mSources.insert(std::make_pair(it->getName(), Source(*it)));
+            mOrder.push_back(it->getName());
+        }
+
+        for (unsigned i = 0; i < mAhead; i++) mWorkers.push_back(std::thread(&DecodePool::work, this));
+    }
+
+    ~DecodePool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+            mWake.notify_all();
+        }
+        for (std::vector<std::thread>::iterator it = mWorkers.begin(); it != mWorkers.end(); it++) it->join();
+    }
+
+    bool contains(const std::string& name) const { return mSources.find(name) != mSources.end(); }
+
+    // Filenames in the order they will be taken, once per use. Decoded images no use is left
+    // for are freed.
+    void schedule(const std::vector<std::string>& uses)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        for (std::map<std::string, Source>::iterator it = mSources.begin(); it != mSources.end(); it++) it->second.uses = 0;
+        for (std::vector<std::string>::const_iterator it = uses.begin(); it != uses.end(); it++)
+        {
+            std::map<std::string, Source>::iterator source = mSources.find(*it);
+            if (source != mSources.end()) source->second.uses++;
+        }
+
+        for (std::map<std::string, Source>::iterator it = mSources.begin(); it != mSources.end(); it++)
+        {
+            if (!it->second.uses && it->second.state == DECODED) release(it->second);
+        }
+
+        mOrder = uses;
+        mScheduled = true;
+        mScan = 0;
+        mTaken = 0;
+        mWake.notify_all();
+    }
+
+    // The decoded file, waits for a worker or decodes it here when none started it yet.
+    // Throws what decoding threw.
+    BitmapHandle take(const std::string& name)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        std::map<std::string, Source>::iterator it = mSources.find(name);
+        if (it == mSources.end()) throw std::runtime_error("Image not decoded ahead:"+name);
+        Source& source = it->second;
+
+        // Taken more often than scheduled, decoded again without keeping it
+        if (source.state == FREED || (mScheduled && !source.uses))
+        {
+            lock.unlock();
+            StageTimer timer("decode", name);
+            return source.content.loadSource();
+        }
+
+        if (source.state == WAITING)
+        {
+            source.state = DECODING;
+            mResident++;
+            decode(source, lock);
+        }
+
+        mDecoded.wait(lock, [&source] { return source.state == DECODED; });
+
+        BitmapHandle bitmap = source.bitmap;
+        std::exception_ptr error = source.error;
+
+        mTaken++;
+        if (source.uses && !--source.uses) release(source);
+        mWake.notify_all();
+
+        if (error) std::rethrow_exception(error);
+        return bitmap;
+    }
+
+protected:
+    enum State { WAITING, DECODING, DECODED, FREED };
+
+    struct Source
+    {
+        Source(const MyContent& content) : content(content), state(WAITING), uses(0) {}
+
+        MyContent content;
+        State state;
+        std::size_t uses; // Left to take, 0 before schedule()
+        BitmapHandle bitmap;
+        std::exception_ptr error;
+    };
+
+    // Next source for a worker, NULL when there is none or the window is full
+    Source* next()
+    {
+        while (mScan < mOrder.size())
+        {
+            std::map<std::string, Source>::iterator it = mSources.find(mOrder[mScan]);
+            if (it != mSources.end() && it->second.state == WAITING) break;
+            mScan++;
+        }
+
+        if (mScan == mOrder.size()) return NULL;
+        if (mResident >= mWindow && mScan >= mTaken + mAhead) return NULL;
+        return &mSources.find(mOrder[mScan])->second;
+    }
+
+    void work()
+    {
+        g_trace.setThreadName("decode");
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        while (true)
+        {
+            Source* source = NULL;
+            mWake.wait(lock, [this, &source] { return mStop || (source = next()) != NULL; });
+            if (mStop) return;
+
+            source->state = DECODING;
+            mResident++;
+            decode(*source, lock);
+        }
+    }
+
+    // Called locked with 'source' marked DECODING, the lock is released meanwhile
+    void decode(Source& source, std::unique_lock<std::mutex>& lock)
+    {
+        lock.unlock();
+
+        BitmapHandle bitmap;
+        std::exception_ptr error;
+        try
+        {
+            StageTimer timer("decode", source.content.getName());
+            bitmap = source.content.loadSource();
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        lock.lock();
+        source.bitmap = bitmap;
+        source.error = error;
+        source.state = DECODED;
+        mDecoded.notify_all();
+
+        // Scheduled out while decoding
+        if (mScheduled && !source.uses) release(source);
+    }
+
+    void release(Source& source)
+    {
+        source.bitmap.reset();
+        source.state = FREED;
+        mResident--;
+    }
+
+    std::map<std::string, Source> mSources;
+    std::vector<std::string> mOrder;
+    std::size_t mWindow;
+    std::size_t mAhead;    // Uses past the last taken one decoded even when the window is full
+    std::size_t mScan;     // Every source before it in mOrder was started
+    std::size_t mTaken;
+    std::size_t mResident; // Decoding or waiting to be taken
+    bool mScheduled;
+    bool mStop;
+    std::vector<std::thread> mWorkers;
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::condition_variable mDecoded;
+};
@@ -0,0 +1,383 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <FreeImage.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <fstream>
+#include <string>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+
+
+enum PngFilter
+{
+    PNG_FILTER_NONE = 0,
+    PNG_FILTER_SUB = 1,
+    PNG_FILTER_UP = 2,
+    PNG_FILTER_AVERAGE = 3,
+    PNG_FILTER_PAETH = 4,
+    PNG_FILTER_ADAPTIVE // Per row, the filter with the smallest sum of absolute differences
+};
+
+
+inline PngFilter parsePngFilter(const std::string& name)
+{
+    if (name == "none") return PNG_FILTER_NONE;
+    if (name == "sub") return PNG_FILTER_SUB;
+    if (name == "up") return PNG_FILTER_UP;
+    if (name == "average") return PNG_FILTER_AVERAGE;
+    if (name == "paeth") return PNG_FILTER_PAETH;
+    if (name == "adaptive") return PNG_FILTER_ADAPTIVE;
+    throw std::runtime_error("Unknown png filter:"+name);
+}
+
+
+class PngOptions
+{
+public:
+    PngOptions() : level(6), filter(PNG_FILTER_ADAPTIVE), threads(0) {}
+
+    int level;        // zlib level, 0-9
+    PngFilter filter;
+    unsigned threads; // 0: one per core
+};
+
+
+// PNG encoder compressing bands of rows in parallel.
+//
+// Every band is an independent raw deflate stream primed with the last 32k of the previous band
+// as dictionary (like pigz), ended with a sync flush so the bands concatenate into one valid
+// zlib stream. The adler32 of the bands are combined for the zlib trailer and each band becomes
+// one IDAT chunk.
+//
+// Rows can be given all at once or a strip at a time, the image only needs to exist one strip
+// at a time.
+class PngWriter
+{
+public:
+    // 'channels' is 4 (RGBA) or 1 (grayscale)
+    PngWriter(const std::string& filename, unsigned width, unsigned height, unsigned channels, const PngOptions& options)
+        : mWidth(width), mHeight(height), mChannels(channels), mRowBytes(width * channels),
+          mOptions(options), mRowsWritten(0), mAdler(adler32(0, NULL, 0))
+    {
+        if (channels != 1 && channels != 4) throw std::runtime_error("Unsupported png channel count");
+
+        mOptions.level = std::min(9, std::max(0, mOptions.level));
+        if (!mOptions.threads) mOptions.threads = std::max(1u, std::thread::hardware_concurrency());
+
+        // Around 256k of pixels per band
+        mBandRows = std::max(1u, (256u * 1024u) / std::max(1u, mRowBytes));
+
+        mFile.open(filename.c_str(), std::ios::binary);
+        if (!mFile.is_open()) throw std::runtime_error("Error opening output file:"+filename);
+
+        static const BYTE signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        mFile.write((const char*)signature, 8);
+
+        BYTE ihdr[13];
+        putBigEndian(ihdr, width);
+        putBigEndian(ihdr + 4, height);
+        ihdr[8] = 8;                      // Bit depth
+        ihdr[9] = channels == 4 ? 6 : 0;  // Color type
+        ihdr[10] = ihdr[11] = ihdr[12] = 0;
+        writeChunk("IHDR", ihdr, 13);
+
+        mPriorRow.assign(mRowBytes, 0);
+    }
+
+    // 'count' rows, top to bottom, 'stride' bytes apart.
+    void writeRows(const BYTE* rows, unsigned count, unsigned stride)
+    {
+        if (mRowsWritten + count > mHeight) throw std::runtime_error("Too many rows written to png");
+        if (!count) return;
+
+        unsigned bandCount = (count + mBandRows - 1) / mBandRows;
+        std::vector<Band> bands(bandCount);
+
+        for (unsigned i = 0; i < bandCount; i++)
+        {
+            Band& band = bands[i];
+            band.rows = rows + (size_t)i * mBandRows * stride;
+            band.count = std::min(mBandRows, count - i * mBandRows);
+            band.prior = i ? band.rows - stride : &mPriorRow[0];
+            band.last = mRowsWritten + i * mBandRows + band.count == mHeight;
+        }
+
+        // Filter everything first, the dictionary of a band is the filtered tail of the previous one.
+        runParallel(bands, stride, &PngWriter::filterBand);
+        for (unsigned i = 0; i < bandCount; i++) bands[i].dictionary = i ? &bands[i - 1].filtered : &mDictionary;
+        runParallel(bands, stride, &PngWriter::deflateBand);
+
+        for (unsigned i = 0; i < bandCount; i++)
+        {
+            Band& band = bands[i];
+
+            if (!mRowsWritten && !i)
+            {
+                // zlib header, the level hint must match the FCHECK bits
+                static const BYTE headers[4][2] = {{0x78, 0x01}, {0x78, 0x5e}, {0x78, 0x9c}, {0x78, 0xda}};
+                int hint = mOptions.level < 2 ? 0 : mOptions.level < 6 ? 1 : mOptions.level == 6 ? 2 : 3;
+                band.compressed.insert(band.compressed.begin(), headers[hint], headers[hint] + 2);
+            }
+
+            mAdler = adler32_combine(mAdler, band.adler, (z_off_t)band.filtered.size());
+
+            if (band.last)
+            {
+                BYTE trailer[4];
+                putBigEndian(trailer, (DWORD)mAdler);
+                band.compressed.insert(band.compressed.end(), trailer, trailer + 4);
+            }
+
+            writeChunk("IDAT", band.compressed.empty() ? NULL : &band.compressed[0], (DWORD)band.compressed.size());
+        }
+
+        // Keep what the next strip needs
+        const std::vector<BYTE>& tail = bands.back().filtered;
+        size_t dictionarySize = std::min<size_t>(32768, tail.size());
+        mDictionary.assign(tail.end() - dictionarySize, tail.end());
+        memcpy(&mPriorRow[0], rows + (size_t)(count - 1) * stride, mRowBytes);
+
+        mRowsWritten += count;
+    }
+
+    void finish()
+    {
+        if (mRowsWritten != mHeight) throw std::runtime_error("Missing rows in png");
+
+        writeChunk("IEND", NULL, 0);
+        mFile.close();
+        if (mFile.fail()) throw std::runtime_error("Error writing png");
+    }
+
+    unsigned getBandRows() const { return mBandRows; }
+
+protected:
+    struct Band
+    {
+        Band() : rows(NULL), prior(NULL), count(0), last(false), dictionary(NULL), adler(0) {}
+
+        const BYTE* rows;
+        const BYTE* prior;
+        unsigned count;
+        bool last;
+        const std::vector<BYTE>* dictionary;
+        std::vector<BYTE> filtered;
+        std::vector<BYTE> compressed;
+        uLong adler;
+    };
+
+    typedef void (PngWriter::*BandTask)(Band&, unsigned stride);
+
+    void runParallel(std::vector<Band>& bands, unsigned stride, BandTask task)
+    {
+        std::atomic<unsigned> next(0);
+        unsigned threads = std::min<unsigned>(mOptions.threads, (unsigned)bands.size());
+
+        struct Worker
+        {
+            // An error is kept for after the joins, the remaining bands are skipped.
+            static void run(PngWriter* writer, std::vector<Band>* bands, unsigned stride, BandTask task, std::atomic<unsigned>* next, std::exception_ptr* error)
+            {
+                try
+                {
+                    for (unsigned i = (*next)++; i < bands->size(); i = (*next)++) (writer->*task)((*bands)[i], stride);
+                }
+                catch (...)
+                {
+                    *error = std::current_exception();
+                    *next = (unsigned)bands->size();
+                }
+            }
+        };
+
+        std::vector<std::exception_ptr> errors(std::max(threads, 1u));
+        std::vector<std::thread> workers;
+        for (unsigned i = 1; i < threads; i++) workers.push_back(std::thread(Worker::run, this, &bands, stride, task, &next, &errors[i]));
+        Worker::run(this, &bands, stride, task, &next, &errors[0]);
+        for (std::vector<std::thread>::iterator it = workers.begin(); it != workers.end(); it++) it->join();
+
+        for (std::vector<std::exception_ptr>::iterator it = errors.begin(); it != errors.end(); it++)
+        {
+            if (*it) std::rethrow_exception(*it);
+        }
+    }
+
+    void filterBand(Band& band, unsigned stride)
+    {
+        band.filtered.resize((size_t)band.count * (mRowBytes + 1));
+
+        // The first row of the image gets an all zero prior row, as the spec says.
+        const BYTE* prior = band.prior;
+        std::vector<BYTE> candidate(mRowBytes);
+
+        for (unsigned y = 0; y < band.count; y++)
+        {
+            const BYTE* row = band.rows + (size_t)y * stride;
+            BYTE* out = &band.filtered[(size_t)y * (mRowBytes + 1)];
+
+            if (mOptions.filter != PNG_FILTER_ADAPTIVE)
+            {
+                out[0] = (BYTE)mOptions.filter;
+                filterRow(mOptions.filter, row, prior, out + 1);
+            }
+            else
+            {
+                unsigned long bestScore = (unsigned long)-1;
+                for (int filter = PNG_FILTER_NONE; filter <= PNG_FILTER_PAETH; filter++)
+                {
+                    filterRow((PngFilter)filter, row, prior, &candidate[0]);
+
+                    unsigned long score = 0;
+                    for (unsigned i = 0; i < mRowBytes; i++) score += abs((signed char)candidate[i]);
+
+                    if (score < bestScore)
+                    {
+                        bestScore = score;
+                        out[0] = (BYTE)filter;
+                        memcpy(out + 1, &candidate[0], mRowBytes);
+                    }
+                }
+            }
+
+            prior = row;
+        }
+
+        band.adler = adler32(adler32(0, NULL, 0), &band.filtered[0], (uInt)band.filtered.size());
+    }
+
+    void filterRow(PngFilter filter, const BYTE* row, const BYTE* prior, BYTE* out) const
+    {
+        const unsigned bpp = mChannels;
+
+        switch (filter)
+        {
+        case PNG_FILTER_NONE:
+            memcpy(out, row, mRowBytes);
+            break;
+        case PNG_FILTER_SUB:
+            for (unsigned i = 0; i < bpp; i++) out[i] = row[i];
+            for (unsigned i = bpp; i < mRowBytes; i++) out[i] = row[i] - row[i - bpp];
+            break;
+        case PNG_FILTER_UP:
+            for (unsigned i = 0; i < mRowBytes; i++) out[i] = row[i] - prior[i];
+            break;
+        case PNG_FILTER_AVERAGE:
+            for (unsigned i = 0; i < bpp; i++) out[i] = row[i] - (prior[i] >> 1);
+            for (unsigned i = bpp; i < mRowBytes; i++) out[i] = row[i] - ((row[i - bpp] + prior[i]) >> 1);
+            break;
+        case PNG_FILTER_PAETH:
+            for (unsigned i = 0; i < bpp; i++) out[i] = row[i] - prior[i];
+            for (unsigned i = bpp; i < mRowBytes; i++)
+            {
+                int a = row[i - bpp], b = prior[i], c = prior[i - bpp];
+                int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+                int predictor = (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+                out[i] = row[i] - predictor;
+            }
+            break;
+        default:
+            throw std::runtime_error("Invalid png filter");
+        }
+    }
+
+    void deflateBand(Band& band, unsigned)
+    {
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+
+        if (deflateInit2(&stream, mOptions.level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            throw std::runtime_error("Error initializing deflate");
+        }
+
+        if (!band.dictionary->empty())
+        {
+            deflateSetDictionary(&stream, &(*band.dictionary)[0], (uInt)band.dictionary->size());
+        }
+
+        band.compressed.resize(deflateBound(&stream, (uLong)band.filtered.size()) + 16);
+
+        stream.next_in = &band.filtered[0];
+        stream.avail_in = (uInt)band.filtered.size();
+        stream.next_out = &band.compressed[0];
+        stream.avail_out = (uInt)band.compressed.size();
+
+        // Sync flush ends the band on a byte boundary without closing the stream.
+        int ret = deflate(&stream, band.last ? Z_FINISH : Z_SYNC_FLUSH);
+        if (ret != (band.last ? Z_STREAM_END : Z_OK) || stream.avail_in)
+        {
+            deflateEnd(&stream);
+            throw std::runtime_error("Error deflating png data");
+        }
+
+        band.compressed.resize(stream.total_out);
+        deflateEnd(&stream);
+    }
+
+    void writeChunk(const char* type, const BYTE* data, DWORD size)
+    {
+        BYTE header[8];
+        putBigEndian(header, size);
+        memcpy(header + 4, type, 4);
+
+        uLong crc = crc32(0, header + 4, 4);
+        if (size) crc = crc32(crc, data, size);
+
+        BYTE trailer[4];
+        putBigEndian(trailer, (DWORD)crc);
+
+        mFile.write((const char*)header, 8);
+        if (size) mFile.write((const char*)data, size);
+        mFile.write((const char*)trailer, 4);
+    }
+
+    static void putBigEndian(BYTE* out, DWORD value)
+    {
+        out[0] = (BYTE)(value >> 24);
+        out[1] = (BYTE)(value >> 16);
+        out[2] = (BYTE)(value >> 8);
+        out[3] = (BYTE)value;
+    }
+
+    unsigned mWidth;
+    unsigned mHeight;
+    unsigned mChannels;
+    unsigned mRowBytes;
+    unsigned mBandRows;
+    PngOptions mOptions;
+    unsigned mRowsWritten;
+    uLong mAdler;
+    std::vector<BYTE> mPriorRow;
+    std::vector<BYTE> mDictionary;
+    std::ofstream mFile;
+};
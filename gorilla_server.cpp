@@ -0,0 +1,741 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+// Pack server for editor tooling, on a Unix domain socket.
+//
+// Stays up between packs: FreeImage is initialised once and decoded inputs are kept in an LRU
+// bounded in memory, checked against the file modification time and size on every use. Requests
+// are packed with libgorilla_binpacker by a pool of workers.
+//
+//   gorilla_server --socket /tmp/gorilla.sock
+//
+// A socket a running server answers on is left to it, the second server exits.
+//
+// Every message, request or reply, is a 4 byte big-endian length followed by that many bytes of
+// text. A connection can send any number of requests, each gets its reply in order. One thread
+// reads the requests of every connection and writes the replies, workers only pack: a connection
+// left open between requests holds no worker. A client stalled for 30 s in the middle of a message
+// is disconnected.
+//
+// A request is one "key value" per line, inputs in the order of the placements in the reply.
+// Relative paths are from the directory the server was started in.
+//
+//   input sprites/ship.png      an image, a font when a .gorilla is next to it
+//   gutter 1                    as the tool options, the library defaults otherwise
+//   align 4
+//   max-size 2048
+//   pages 2
+//   output build/atlas.png      also write the pages (png) and their .gorilla, named as the tool names them
+//   png-fast                    as --png-fast, for previews: most of a request writing its atlas is deflate
+//
+// The reply is "ok" or "error message" on its first line, then for "ok":
+//
+//   size 256 128 1              page width, height and count
+//   whitepixel 250 3
+//   place 0 16 0 24 24 sprites/ship.png    page, x, y, width, height, input
+//   atlas build/atlas.png       every file written for 'output'
+
+
+#include "gorilla_api.h"
+#include "gorilla_font.hpp"
+#include "gorilla_image.hpp"
+#include "gorilla_png.hpp"
+
+#include <FreeImage.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+
+
+const std::size_t g_max_message_bytes = 16 << 20; // Longer lengths are taken for a broken client
+char g_socket_path[sizeof(((sockaddr_un*)0)->sun_path)]; // Removed on SIGINT and SIGTERM
+const std::chrono::seconds g_stall_timeout(30); // Partly sent requests or unread replies
+
+
+// An input as decoded, with what its files were when it was
+struct DecodedInput
+{
+    RgbaImage pixels;
+    bool font;
+    std::string gorilla;             // .gorilla text of a font
+
+    struct stat image;
+    struct stat fontFile;
+};
+
+
+// Decoded inputs by filename, the least recently used are dropped past 'maxBytes'.
+// An entry dropped while a request holds it stays alive until that request is done.
+class InputCache
+{
+public:
+    InputCache(std::size_t maxBytes) : mMaxBytes(maxBytes), mBytes(0) {}
+
+    std::shared_ptr<const DecodedInput> get(const std::string& filename)
+    {
+        struct stat image, fontFile;
+        if (stat(filename.c_str(), &image)) throw std::runtime_error("Input not found:"+filename);
+        bool font = !stat((stripExtension(filename) + ".gorilla").c_str(), &fontFile);
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+
+            std::map<std::string, Entry>::iterator it = mEntries.find(filename);
+            if (it != mEntries.end())
+            {
+                const DecodedInput& input = *it->second.input;
+                if (sameFile(input.image, image) && input.font == font && (!font || sameFile(input.fontFile, fontFile)))
+                {
+                    mOrder.splice(mOrder.begin(), mOrder, it->second.order);
+                    return it->second.input;
+                }
+                erase(it);
+            }
+        }
+
+        // Decoded without the lock, requests for other inputs go on meanwhile
+        std::shared_ptr<DecodedInput> input = decode(filename);
+        input->image = image;
+        input->font = font;
+        if (font)
+        {
+            input->fontFile = fontFile;
+            input->gorilla = readFile(stripExtension(filename) + ".gorilla");
+        }
+
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        std::map<std::string, Entry>::iterator it = mEntries.find(filename);
+        if (it != mEntries.end()) erase(it); // Decoded by another request at the same time
+
+        mOrder.push_front(filename);
+        Entry entry = { input, mOrder.begin(), bytesOf(*input) };
+        mEntries[filename] = entry;
+        mBytes += entry.bytes;
+
+        // The newest is kept even when it is larger than the whole cache
+        while (mBytes > mMaxBytes && mOrder.size() > 1) erase(mEntries.find(mOrder.back()));
+
+        return input;
+    }
+
+protected:
+    struct Entry
+    {
+        std::shared_ptr<const DecodedInput> input;
+        std::list<std::string>::iterator order;
+        std::size_t bytes;
+    };
+
+    static bool sameFile(const struct stat& a, const struct stat& b)
+    {
+        return a.st_ino == b.st_ino && a.st_size == b.st_size &&
+               a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+    }
+
+    static std::size_t bytesOf(const DecodedInput& input)
+    {
+        return input.pixels.getPixels().size() + input.gorilla.size() + sizeof(DecodedInput);
+    }
+
+    static std::string readFile(const std::string& filename)
+    {
+        std::ifstream file(filename.c_str(), std::ios::binary);
+        if (!file.is_open()) throw std::runtime_error("Error reading:"+filename);
+
+        std::ostringstream text;
+        text << file.rdbuf();
+        return text.str();
+    }
+
+    static std::shared_ptr<DecodedInput> decode(const std::string& filename)
+    {
+        FREE_IMAGE_FORMAT format = FreeImage_GetFileType(filename.c_str(), 0);
+        if (format == FIF_UNKNOWN) format = FreeImage_GetFIFFromFilename(filename.c_str());
+        if (format == FIF_UNKNOWN) throw std::runtime_error("Unknown image format:"+filename);
+
+        FIBITMAP* loaded = FreeImage_Load(format, filename.c_str(), 0);
+        if (!loaded) throw std::runtime_error("Error loading image:"+filename);
+
+        std::shared_ptr<DecodedInput> input = std::make_shared<DecodedInput>();
+        try
+        {
+            input->pixels = RgbaImage(loaded);
+        }
+        catch (...)
+        {
+            FreeImage_Unload(loaded);
+            throw;
+        }
+
+        FreeImage_Unload(loaded);
+        return input;
+    }
+
+    void erase(std::map<std::string, Entry>::iterator it)
+    {
+        mBytes -= it->second.bytes;
+        mOrder.erase(it->second.order);
+        mEntries.erase(it);
+    }
+
+    std::size_t mMaxBytes;
+    std::size_t mBytes;
+    std::map<std::string, Entry> mEntries;
+    std::list<std::string> mOrder; // Most recently used first
+    std::mutex mMutex;
+};
+
+
+// Frees the atlas at the end of the scope
+class AtlasHandle
+{
+public:
+    AtlasHandle(const gorilla_options& options) : mAtlas(gorilla_atlas_create(&options))
+    {
+        if (!mAtlas) throw std::runtime_error("Out of memory");
+    }
+
+    ~AtlasHandle() { gorilla_atlas_destroy(mAtlas); }
+
+    gorilla_atlas* get() const { return mAtlas; }
+
+    std::string getError() const
+    {
+        std::string error(gorilla_atlas_get_error(mAtlas, NULL, 0), 0);
+        if (error.empty()) return "Unknown error";
+        gorilla_atlas_get_error(mAtlas, &error[0], error.size() + 1);
+        return error;
+    }
+
+protected:
+    gorilla_atlas* mAtlas;
+
+    AtlasHandle(const AtlasHandle&);
+    AtlasHandle& operator=(const AtlasHandle&);
+};
+
+
+unsigned parseCount(const std::string& key, const std::string& value)
+{
+    char* end = NULL;
+    unsigned long count = strtoul(value.c_str(), &end, 10);
+    if (value.empty() || *end || count > 65536) throw std::runtime_error("Bad value for "+key+":"+value);
+    return (unsigned)count;
+}
+
+
+// Packs the inputs of a request, writes the atlas when asked and returns the reply
+std::string handleRequest(const std::string& request, InputCache& cache)
+{
+    gorilla_options options;
+    gorilla_default_options(&options);
+
+    std::vector<std::string> inputs;
+    std::string output;
+    PngOptions pngOptions;
+
+    std::istringstream lines(request);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+        if (line.empty()) continue;
+
+        std::size_t space = line.find(' ');
+        std::string key = line.substr(0, space);
+        std::string value = space == std::string::npos ? "" : line.substr(space + 1);
+
+        if (key == "input") inputs.push_back(value);
+        else if (key == "output") output = value;
+        else if (key == "png-fast")
+        {
+            pngOptions.level = 1;
+            pngOptions.filter = PNG_FILTER_UP;
+        }
+        else if (key == "gutter") options.gutter = parseCount(key, value);
+        else if (key == "align") options.block_align = parseCount(key, value);
+        else if (key == "max-size") options.max_size = parseCount(key, value);
+        else if (key == "pages") options.max_pages = parseCount(key, value);
+        else throw std::runtime_error("Unknown request key:"+key);
+    }
+
+    if (inputs.empty()) throw std::runtime_error("No input");
+
+    AtlasHandle atlas(options);
+
+    for (std::vector<std::string>::const_iterator it = inputs.begin(); it != inputs.end(); it++)
+    {
+        std::shared_ptr<const DecodedInput> input = cache.get(*it);
+        const RgbaImage& pixels = input->pixels;
+
+        int index = input->font ?
+            gorilla_atlas_add_font(atlas.get(), it->c_str(), pixels.getWidth(), pixels.getHeight(), pixels.getRow(0), 0,
+                                   input->gorilla.data(), input->gorilla.size()) :
+            gorilla_atlas_add_image(atlas.get(), it->c_str(), pixels.getWidth(), pixels.getHeight(), pixels.getRow(0), 0);
+        if (index < 0) throw std::runtime_error(atlas.getError());
+    }
+
+    if (gorilla_atlas_pack(atlas.get())) throw std::runtime_error(atlas.getError());
+
+    unsigned width, height, pages, whiteX, whiteY;
+    gorilla_atlas_get_size(atlas.get(), &width, &height, &pages);
+    gorilla_atlas_get_whitepixel(atlas.get(), &whiteX, &whiteY);
+
+    std::ostringstream reply;
+    reply << "ok\n";
+    reply << "size " << width << " " << height << " " << pages << "\n";
+    reply << "whitepixel " << whiteX << " " << whiteY << "\n";
+
+    for (int i = 0; i < (int)inputs.size(); i++)
+    {
+        gorilla_placement placement;
+        gorilla_atlas_get_placement(atlas.get(), i, &placement);
+        reply << "place " << placement.page << " " << placement.x << " " << placement.y << " "
+              << placement.width << " " << placement.height << " " << inputs[i] << "\n";
+    }
+
+    if (!output.empty())
+    {
+        for (unsigned page = 0; page < pages; page++)
+        {
+            std::string base = pages == 1 ? stripExtension(output) : stripExtension(output) + "_" + std::to_string(page);
+            std::string filename = base + ".png";
+
+            const unsigned char* rgba = gorilla_atlas_get_page(atlas.get(), page);
+            if (!rgba) throw std::runtime_error(atlas.getError());
+
+            PngWriter writer(filename, width, height, 4, pngOptions);
+            writer.writeRows(rgba, height, width * 4);
+            writer.finish();
+
+            std::string gorilla(gorilla_atlas_get_gorilla(atlas.get(), page, filename.c_str(), NULL, 0), 0);
+            if (gorilla.empty()) throw std::runtime_error(atlas.getError());
+            gorilla_atlas_get_gorilla(atlas.get(), page, filename.c_str(), &gorilla[0], gorilla.size() + 1);
+
+            std::string gorillaFilename = base + ".gorilla";
+            std::ofstream file(gorillaFilename.c_str(), std::ios::binary);
+            file << gorilla;
+            if (!file.good()) throw std::runtime_error("Error writing:"+gorillaFilename);
+
+            reply << "atlas " << filename << "\n";
+        }
+    }
+
+    return reply.str();
+}
+
+
+// A client connection, only the poll thread touches it
+struct Connection
+{
+    Connection(int fd) : fd(fd), busy(false), ended(false), lastActive(std::chrono::steady_clock::now()) {}
+
+    int fd;
+    std::string input;  // Bytes read past the last request handed to a worker
+    std::string output; // Reply bytes not sent yet
+    bool busy;          // A worker has its request, the next one waits so replies stay in order
+    bool ended;         // The client sends nothing more, it still gets the replies of what it sent
+    std::chrono::steady_clock::time_point lastActive;
+
+    // Stalled in the middle of a message. Idle between requests or waiting on a worker is fine.
+    bool stalled(std::chrono::steady_clock::time_point now) const
+    {
+        return !busy && (!input.empty() || !output.empty()) && now - lastActive > g_stall_timeout;
+    }
+
+    bool finished() const { return ended && !busy && output.empty(); }
+};
+
+
+// Requests waiting for a worker and replies waiting for the poll thread, which a byte on a pipe wakes
+class RequestQueue
+{
+public:
+    struct Job
+    {
+        unsigned long long connection;
+        std::string text;
+    };
+
+    RequestQueue()
+    {
+        if (pipe(mWake)) throw std::runtime_error("Can't create pipe");
+        fcntl(mWake[0], F_SETFL, O_NONBLOCK);
+    }
+
+    int getWakeFd() const { return mWake[0]; }
+
+    void pushRequest(unsigned long long connection, const std::string& text)
+    {
+        Job job = { connection, text };
+        std::lock_guard<std::mutex> lock(mMutex);
+        mRequests.push_back(job);
+        mReady.notify_one();
+    }
+
+    Job popRequest()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mReady.wait(lock, [this]() { return !mRequests.empty(); });
+        Job job = mRequests.front();
+        mRequests.pop_front();
+        return job;
+    }
+
+    void pushReply(unsigned long long connection, const std::string& text)
+    {
+        Job job = { connection, text };
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mReplies.push_back(job);
+        }
+        char byte = 0;
+        while (write(mWake[1], &byte, 1) < 0 && errno == EINTR) {}
+    }
+
+    std::vector<Job> takeReplies()
+    {
+        char bytes[256];
+        while (read(mWake[0], bytes, sizeof(bytes)) > 0) {}
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        std::vector<Job> replies(mReplies.begin(), mReplies.end());
+        mReplies.clear();
+        return replies;
+    }
+
+protected:
+    std::deque<Job> mRequests;
+    std::deque<Job> mReplies;
+    std::mutex mMutex;
+    std::condition_variable mReady;
+    int mWake[2];
+};
+
+
+std::string frame(const std::string& text)
+{
+    unsigned char header[4] = { (unsigned char)(text.size() >> 24), (unsigned char)(text.size() >> 16),
+                                (unsigned char)(text.size() >> 8), (unsigned char)text.size() };
+    return std::string((const char*)header, 4) + text;
+}
+
+
+// Hands the next complete request of the connection to a worker. False when the client broke the framing.
+bool dispatch(unsigned long long id, Connection& connection, RequestQueue& queue)
+{
+    if (connection.busy || !connection.output.empty() || connection.input.size() < 4) return true;
+
+    const unsigned char* header = (const unsigned char*)connection.input.data();
+    std::size_t length = ((std::size_t)header[0] << 24) | (header[1] << 16) | (header[2] << 8) | header[3];
+    if (length > g_max_message_bytes) return false;
+    if (connection.input.size() < 4 + length) return true;
+
+    queue.pushRequest(id, connection.input.substr(4, length));
+    connection.input.erase(0, 4 + length);
+    connection.busy = true;
+    return true;
+}
+
+
+// Reads what the client sent. False when the connection failed or the client broke the framing.
+bool receiveRequests(unsigned long long id, Connection& connection, RequestQueue& queue)
+{
+    char bytes[65536];
+    while (true)
+    {
+        ssize_t count = read(connection.fd, bytes, sizeof(bytes));
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (count < 0) return false;
+        if (count == 0)
+        {
+            connection.ended = true;
+            break;
+        }
+
+        connection.input.append(bytes, count);
+        connection.lastActive = std::chrono::steady_clock::now();
+        if (connection.input.size() > 4 + g_max_message_bytes) break; // Checked by dispatch
+    }
+    return dispatch(id, connection, queue);
+}
+
+
+// Sends what the socket takes of the reply. False when the client is gone.
+bool sendReply(unsigned long long id, Connection& connection, RequestQueue& queue)
+{
+    while (!connection.output.empty())
+    {
+        ssize_t count = ::send(connection.fd, connection.output.data(), connection.output.size(), MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+        if (count <= 0) return false;
+
+        connection.output.erase(0, count);
+        connection.lastActive = std::chrono::steady_clock::now();
+    }
+
+    // A request sent while the previous one was packed
+    return dispatch(id, connection, queue);
+}
+
+
+void packRequests(RequestQueue& queue, InputCache& cache)
+{
+    while (true)
+    {
+        RequestQueue::Job job = queue.popRequest();
+
+        std::string reply;
+        try
+        {
+            reply = handleRequest(job.text, cache);
+        }
+        catch (const std::exception& e)
+        {
+            reply = std::string("error ") + e.what() + "\n";
+        }
+
+        queue.pushReply(job.connection, reply);
+    }
+}
+
+
+// Accepts connections, reads their requests and writes the replies. Workers only pack, so a client
+// keeping its connection open between requests, or a slow one, holds no worker.
+void serveConnections(int listener, RequestQueue& queue)
+{
+    typedef std::map<unsigned long long, Connection> ConnectionMap;
+    ConnectionMap connections;
+    unsigned long long nextId = 1; // Never reused, a reply for a closed connection is dropped
+
+    while (true)
+    {
+        std::vector<pollfd> fds;
+        std::vector<unsigned long long> ids;
+
+        pollfd wake = { queue.getWakeFd(), POLLIN, 0 };
+        pollfd accepting = { listener, POLLIN, 0 };
+        fds.push_back(wake);
+        fds.push_back(accepting);
+
+        for (ConnectionMap::iterator it = connections.begin(); it != connections.end(); it++)
+        {
+            // Nothing is read while a request is packed or its reply is sent, hang-ups are still reported
+            Connection& connection = it->second;
+            short events = !connection.output.empty() ? POLLOUT : connection.busy || connection.ended ? 0 : POLLIN;
+            pollfd entry = { connection.fd, events, 0 };
+            fds.push_back(entry);
+            ids.push_back(it->first);
+        }
+
+        // Woken every second to drop stalled clients
+        if (poll(&fds[0], fds.size(), 1000) < 0)
+        {
+            if (errno == EINTR) continue;
+            perror("poll");
+            return;
+        }
+
+        std::vector<unsigned long long> closed;
+
+        if (fds[0].revents)
+        {
+            std::vector<RequestQueue::Job> replies = queue.takeReplies();
+            for (std::vector<RequestQueue::Job>::iterator it = replies.begin(); it != replies.end(); it++)
+            {
+                ConnectionMap::iterator connection = connections.find(it->connection);
+                if (connection == connections.end()) continue;
+
+                connection->second.busy = false;
+                connection->second.output = frame(it->text);
+                if (!sendReply(it->connection, connection->second, queue)) closed.push_back(it->connection);
+            }
+        }
+
+        for (std::size_t i = 2; i < fds.size(); i++)
+        {
+            ConnectionMap::iterator connection = connections.find(ids[i - 2]);
+            if (!fds[i].revents || connection == connections.end()) continue;
+
+            bool open;
+            if (fds[i].revents & POLLOUT) open = sendReply(ids[i - 2], connection->second, queue);
+            else if (fds[i].revents & POLLIN) open = receiveRequests(ids[i - 2], connection->second, queue);
+            else open = false; // Hung up or failed, a reply being packed is dropped
+
+            if (!open) closed.push_back(ids[i - 2]);
+        }
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        for (ConnectionMap::iterator it = connections.begin(); it != connections.end(); it++)
+        {
+            if (it->second.stalled(now) || it->second.finished()) closed.push_back(it->first);
+        }
+
+        for (std::vector<unsigned long long>::iterator it = closed.begin(); it != closed.end(); it++)
+        {
+            ConnectionMap::iterator connection = connections.find(*it);
+            if (connection == connections.end()) continue;
+            close(connection->second.fd);
+            connections.erase(connection);
+        }
+
+        if (fds[1].revents)
+        {
+            while (true)
+            {
+                int fd = accept(listener, NULL, NULL);
+                if (fd < 0)
+                {
+                    if (errno == EINTR || errno == ECONNABORTED) continue;
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                    perror("accept");
+                    return;
+                }
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                connections.insert(std::make_pair(nextId++, Connection(fd)));
+            }
+        }
+    }
+}
+
+
+void removeSocket(int)
+{
+    unlink(g_socket_path);
+    _exit(0);
+}
+
+
+int main(int argc, char** argv)
+{
+    std::string socketPath;
+    unsigned cacheMegabytes = 256;
+    unsigned workers = 0;
+
+    // Parse arguments
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--socket") && ++i < argc) socketPath = argv[i];
+        else if (!strcmp(argv[i], "--cache-mb") && ++i < argc) cacheMegabytes = atoi(argv[i]);
+        else if (!strcmp(argv[i], "--workers") && ++i < argc) workers = atoi(argv[i]);
+        else
+        {
+            std::cout<<"Usage: --socket path [ --cache-mb 256 ] [ --workers cores ]"<<std::endl;
+            return 1;
+        }
+    }
+
+    if (socketPath.empty() || socketPath.size() >= sizeof(g_socket_path))
+    {
+        std::cout<<"--socket takes a path shorter than "<<sizeof(g_socket_path)<<" characters"<<std::endl;
+        return 1;
+    }
+
+    if (!workers) workers = std::max(1u, std::thread::hardware_concurrency());
+
+    FreeImage_Initialise();
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+    {
+        perror("socket");
+        return 1;
+    }
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath.c_str());
+    strcpy(g_socket_path, socketPath.c_str());
+
+    // A socket file left behind by a killed server refuses connections and is replaced,
+    // one a running server answers on is left to it
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe < 0)
+    {
+        perror("socket");
+        return 1;
+    }
+    if (!connect(probe, (sockaddr*)&address, sizeof(address)))
+    {
+        std::cout<<"A server is already listening on "<<socketPath<<std::endl;
+        return 1;
+    }
+    if (errno == ECONNREFUSED) unlink(socketPath.c_str());
+    close(probe);
+
+    if (bind(listener, (sockaddr*)&address, sizeof(address)) || listen(listener, 64))
+    {
+        perror(socketPath.c_str());
+        return 1;
+    }
+
+    signal(SIGINT, removeSocket);
+    signal(SIGTERM, removeSocket);
+    signal(SIGPIPE, SIG_IGN);
+
+    InputCache cache((std::size_t)cacheMegabytes << 20);
+    RequestQueue queue;
+    fcntl(listener, F_SETFL, O_NONBLOCK);
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < workers; i++) threads.push_back(std::thread(packRequests, std::ref(queue), std::ref(cache)));
+
+    printf("Listening on %s, %u workers, %u MB of decoded inputs\n", socketPath.c_str(), workers, cacheMegabytes);
+    fflush(stdout);
+
+    serveConnections(listener, queue);
+
+    unlink(socketPath.c_str());
+    _exit(1);
+}
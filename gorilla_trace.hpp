@@ -0,0 +1,253 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <stdio.h>
+
+
+// Time spent in each stage of a build, written by --stats. Stages running on worker threads add up
+// their busy time, so stages overlapping each other can sum past the total.
+class BuildStats
+{
+public:
+    void addTime(const std::string& stage, double seconds)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mSeconds[stage] += seconds;
+    }
+
+    void setValue(const std::string& key, long long value)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mValues[key] = value;
+    }
+
+    // One "key value" per line sorted by key, times in milliseconds: diffs between builds line up
+    void write(std::ostream& file)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        for (std::map<std::string, long long>::const_iterator it = mValues.begin(); it != mValues.end(); it++)
+        {
+            file << it->first << " " << it->second << '\n';
+        }
+        for (std::map<std::string, double>::const_iterator it = mSeconds.begin(); it != mSeconds.end(); it++)
+        {
+            char ms[32];
+            snprintf(ms, sizeof(ms), "%.1f", it->second * 1000.0);
+            file << "time_" << it->first << "_ms " << ms << '\n';
+        }
+    }
+
+protected:
+    std::map<std::string, double> mSeconds;
+    std::map<std::string, long long> mValues;
+    std::mutex mMutex;
+};
+
+extern BuildStats g_stats; // Defined in gorilla_binpacker.cpp
+
+
+// Timeline of a build for --trace, in the Chrome trace event format (chrome://tracing, Perfetto).
+//
+// Each thread appends its spans to its own buffer, taken once from the recorder the first time the
+// thread records, so recording never waits on another thread. The buffers are read by write(),
+// once the threads recording them are done.
+class TraceRecorder
+{
+public:
+    TraceRecorder() : mEnabled(false) {}
+
+    // Before the threads to trace start
+    void start()
+    {
+        mStart = std::chrono::steady_clock::now();
+        mEnabled = true;
+        setThreadName("main");
+    }
+
+    bool isEnabled() const { return mEnabled; }
+
+    // Shown as the row of the calling thread
+    void setThreadName(const char* name)
+    {
+        if (mEnabled) getBuffer().name = name;
+    }
+
+    void addSpan(const char* category, const std::string& name,
+                 std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+    {
+        Span span = { category, name, start, end };
+        getBuffer().spans.push_back(span);
+    }
+
+    void write(const std::string& filename)
+    {
+        std::ofstream file(filename.c_str());
+        if (!file.is_open()) throw std::runtime_error("Error writing trace:"+filename);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+        bool first = true;
+        for (std::size_t tid = 0; tid < mBuffers.size(); tid++)
+        {
+            const ThreadBuffer& buffer = *mBuffers[tid];
+
+            file << (first ? "" : ",\n");
+            file << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << tid + 1 << ",\"name\":\"thread_name\",\"args\":{\"name\":\"" << escape(buffer.name) << "\"}}";
+            first = false;
+
+            for (std::vector<Span>::const_iterator it = buffer.spans.begin(); it != buffer.spans.end(); it++)
+            {
+                char times[64];
+                snprintf(times, sizeof(times), "\"ts\":%.3f,\"dur\":%.3f",
+                         std::chrono::duration<double, std::micro>(it->start - mStart).count(),
+                         std::chrono::duration<double, std::micro>(it->end - it->start).count());
+
+                file << ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":" << tid + 1 << "," << times;
+                file << ",\"cat\":\"" << it->category << "\",\"name\":\"" << escape(it->name) << "\"}";
+            }
+        }
+
+        file << "\n]}\n";
+    }
+
+protected:
+    struct Span
+    {
+        const char* category;
+        std::string name;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point end;
+    };
+
+    struct ThreadBuffer
+    {
+        std::string name;
+        std::vector<Span> spans;
+    };
+
+    // The buffer of the calling thread, the lock is only taken on its first span
+    ThreadBuffer& getBuffer()
+    {
+        static thread_local ThreadBuffer* buffer = NULL;
+        if (!buffer)
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mBuffers.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer()));
+            buffer = mBuffers.back().get();
+            buffer->name = "worker";
+        }
+        return *buffer;
+    }
+
+    static std::string escape(const std::string& text)
+    {
+        std::string escaped;
+        for (std::size_t i = 0; i < text.size(); i++)
+        {
+            unsigned char c = text[i];
+            if (c == '"' || c == '\\') escaped += '\\';
+            if (c < 0x20)
+            {
+                char code[8];
+                snprintf(code, sizeof(code), "\\u%04x", c);
+                escaped += code;
+            }
+            else escaped += c;
+        }
+        return escaped;
+    }
+
+    bool mEnabled;
+    std::chrono::steady_clock::time_point mStart;
+    std::vector<std::unique_ptr<ThreadBuffer> > mBuffers;
+    std::mutex mMutex;
+};
+
+extern TraceRecorder g_trace; // Defined in gorilla_binpacker.cpp
+
+
+// A span of the trace from construction to the end of the scope, nothing when not tracing.
+// 'detail' follows the category in the span name (a filename, a size).
+class TraceSpan
+{
+public:
+    TraceSpan(const char* category, const std::string& detail = "") : mCategory(category), mRunning(g_trace.isEnabled())
+    {
+        if (!mRunning) return;
+        mName = detail.empty() ? category : std::string(category) + " " + detail;
+        mStart = std::chrono::steady_clock::now();
+    }
+
+    ~TraceSpan() { stop(); }
+
+    void stop()
+    {
+        if (!mRunning) return;
+        mRunning = false;
+        g_trace.addSpan(mCategory, mName, mStart, std::chrono::steady_clock::now());
+    }
+
+protected:
+    const char* mCategory;
+    std::string mName;
+    std::chrono::steady_clock::time_point mStart;
+    bool mRunning;
+};
+
+
+// Adds the time until stop() or the end of the scope to a stage of g_stats, and is a span of the trace
+class StageTimer
+{
+public:
+    StageTimer(const char* stage, const std::string& detail = "")
+        : mStage(stage), mSpan(stage, detail), mStart(std::chrono::steady_clock::now()), mRunning(true) {}
+
+    ~StageTimer() { stop(); }
+
+    void stop()
+    {
+        if (!mRunning) return;
+        mRunning = false;
+        mSpan.stop();
+        g_stats.addTime(mStage, std::chrono::duration<double>(std::chrono::steady_clock::now() - mStart).count());
+    }
+
+protected:
+    const char* mStage;
+    TraceSpan mSpan;
+    std::chrono::steady_clock::time_point mStart;
+    bool mRunning;
+};
@@ -0,0 +1,132 @@
+/*
+Copyright (c) 2014 Sebastien Raymond <github.com/glittercutter>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#pragma once
+
+#include "gorilla_binpacker.hpp"
+
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <stdexcept>
+#include <utility>
+
+
+// Watch input images and their .gorilla font sidecar with inotify.
+//
+// Editors usually save by writing a temporary file and renaming it over the
+// original, which drops a watch placed on the file itself. The parent
+// directories are watched instead and events are matched by name.
+class InputWatcher
+{
+public:
+    InputWatcher(const std::deque<std::string>& inputFilenames) : mFd(-1)
+    {
+        mFd = inotify_init1(IN_CLOEXEC);
+        if (mFd < 0) throw std::runtime_error("Error initializing inotify");
+
+        for (std::deque<std::string>::const_iterator it = inputFilenames.begin(); it != inputFilenames.end(); it++)
+        {
+            int wd = watchDirectory(stripFilename(*it));
+            mWatched[std::make_pair(wd, stripPath(*it))] = *it;
+            mWatched[std::make_pair(wd, stripPath(stripExtension(*it)) + ".gorilla")] = *it;
+        }
+    }
+
+    ~InputWatcher()
+    {
+        if (mFd >= 0) close(mFd);
+    }
+
+    // Block until at least one input changed, then keep collecting events
+    // until things settle for 'settleMs' so a save burst is handled as one.
+    void waitForChanges(std::set<std::string>& changedFilenames, int settleMs = 50)
+    {
+        changedFilenames.clear();
+
+        int timeout = -1;
+        while (true)
+        {
+            struct pollfd pfd;
+            pfd.fd = mFd;
+            pfd.events = POLLIN;
+
+            int ret = poll(&pfd, 1, timeout);
+            if (ret < 0) throw std::runtime_error("Error waiting for inotify events");
+            if (ret == 0) return; // Settled
+
+            readEvents(changedFilenames);
+            if (!changedFilenames.empty()) timeout = settleMs;
+        }
+    }
+
+protected:
+    static std::string stripFilename(const std::string& filename)
+    {
+        std::size_t symbolPos = filename.find_last_of("/\\");
+        if (symbolPos == std::string::npos) return ".";
+        if (symbolPos == 0) return "/";
+        return filename.substr(0, symbolPos);
+    }
+
+    int watchDirectory(const std::string& directory)
+    {
+        std::map<std::string, int>::iterator found = mDirectories.find(directory);
+        if (found != mDirectories.end()) return found->second;
+
+        int wd = inotify_add_watch(mFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        if (wd < 0) throw std::runtime_error("Error watching directory:"+directory);
+
+        mDirectories[directory] = wd;
+        return wd;
+    }
+
+    void readEvents(std::set<std::string>& changedFilenames)
+    {
+        char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+        ssize_t len = read(mFd, buffer, sizeof(buffer));
+        if (len <= 0) return;
+
+        for (char* ptr = buffer; ptr < buffer + len; )
+        {
+            const struct inotify_event* event = (const struct inotify_event*)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            if (!event->len) continue;
+
+            std::map<std::pair<int, std::string>, std::string>::const_iterator found =
+                mWatched.find(std::make_pair(event->wd, std::string(event->name)));
+            if (found != mWatched.end()) changedFilenames.insert(found->second);
+        }
+    }
+
+    int mFd;
+    std::map<std::string, int> mDirectories;
+    std::map<std::pair<int, std::string>, std::string> mWatched; // (wd, name) -> input filename
+};